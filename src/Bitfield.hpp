@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+//one bit per piece, stored in 64 bit words in wire order: piece 0 is the most significant bit of the
+//first word, so converting to and from a BITFIELD payload is a byte swap per word. bits past size()
+//are always zero, which lets the bulk operations work on whole words (and 4 words at a time with AVX2)
+//
+//set()/reset()/test() are atomic per bit, so pieces can be marked on a disk thread while reactor
+//threads read. count() is maintained as bits change. bulk operations read without locking and only
+//see a consistent picture when nothing is being set at the same time
+class Bitfield {
+public:
+	Bitfield() = default;
+	explicit Bitfield(size_t num_bits, bool value = false);
+
+	Bitfield(const Bitfield& other);
+	Bitfield& operator=(const Bitfield& other);
+
+	//resizes and sets every bit to value
+	void assign(size_t num_bits, bool value);
+	//takes a BITFIELD payload (MSB first), missing bytes count as zero and spare bits are dropped
+	void assign_bytes(std::span<const uint8_t> bytes);
+	void assign_bytes(std::span<const char> bytes);
+	//the BITFIELD payload, (size()+7)/8 bytes
+	std::vector<uint8_t> to_bytes() const;
+
+	size_t size() const { return num_bits_; }
+	size_t count() const { return __atomic_load_n(&count_, __ATOMIC_RELAXED); }
+	bool all() const { return count() == num_bits_; }
+	bool none() const { return count() == 0; }
+
+	bool test(size_t i) const {
+		if (i >= num_bits_){
+			return false;
+		}
+		return (__atomic_load_n(&words_[i >> 6], __ATOMIC_ACQUIRE) & mask(i)) != 0;
+	}
+	//true if the bit changed
+	bool set(size_t i);
+	bool reset(size_t i);
+
+	//first index >= from that is set in a and clear in b (what a has that b lacks), -1 if none
+	static long first_and_not(const Bitfield& a, const Bitfield& b, size_t from = 0);
+	//how many bits are set in a and clear in b
+	static size_t count_and_not(const Bitfield& a, const Bitfield& b);
+	//always the scalar code, to check the AVX2 kernels against
+	static long first_and_not_portable(const Bitfield& a, const Bitfield& b, size_t from = 0);
+	static size_t count_and_not_portable(const Bitfield& a, const Bitfield& b);
+
+	//true when the AVX2 kernels are in use
+	static bool accelerated();
+
+private:
+	using FirstAndNot = size_t (*)(const uint64_t*, const uint64_t*, size_t, size_t);
+	using CountAndNot = size_t (*)(const uint64_t*, const uint64_t*, size_t);
+	static long first_and_not(const Bitfield& a, const Bitfield& b, size_t from, FirstAndNot kernel);
+	static size_t count_and_not(const Bitfield& a, const Bitfield& b, CountAndNot kernel);
+
+	static uint64_t mask(size_t i) { return uint64_t(1) << (63 - (i & 63)); }
+	void recount();
+
+	std::vector<uint64_t> words_;
+	size_t num_bits_ = 0;
+	size_t count_ = 0;
+};
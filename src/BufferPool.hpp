@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//recycled piece-sized buffers for received pieces on their way from the socket to the disk (and the
+//piece cache). a buffer is handed out as a shared pointer that the pool keeps a reference to; once
+//every other holder has let go (use count back to 1) the buffer, with its capacity, is handed out again
+//
+//requests larger than the buffer size, or beyond max_buffers, get a plain one-off allocation
+class BufferPool {
+public:
+	using Buffer = std::shared_ptr<std::vector<char>>;
+
+	struct Stats {
+		uint64_t reused = 0;
+		uint64_t allocated = 0; //pooled buffers created
+		uint64_t unpooled = 0;  //one-off buffers (oversized or pool exhausted)
+	};
+
+	BufferPool(size_t buffer_size, size_t max_buffers);
+
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+
+	//a buffer of exactly len bytes (contents unspecified)
+	Buffer acquire(size_t len);
+
+	size_t buffer_size() const { return buffer_size_; }
+	Stats stats() const;
+
+private:
+	size_t buffer_size_;
+	size_t max_buffers_;
+	std::vector<Buffer> buffers_;
+	size_t next_ = 0; //where the search for a free buffer starts
+	Stats stats_;
+	mutable std::mutex mu_;
+};
@@ -0,0 +1,166 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+#include "Header.hpp"
+
+//wire header of one frame (4 byte length + 1 byte type) built in place
+//small payloads (HAVE/REQUEST indices and the like) are copied right behind it
+struct FrameHead {
+	static const uint32_t INLINE_PAYLOAD = 16;
+
+	char bytes[5 + INLINE_PAYLOAD];
+	uint32_t size;
+
+	FrameHead(uint8_t type, uint32_t payload_len) : size(5){
+		uint32_t nlen = htonl(1 + payload_len);
+		std::memcpy(bytes, &nlen, 4);
+		bytes[4] = static_cast<char>(type);
+	}
+
+	//appends part of the payload to the header itself
+	void put(const void* data, uint32_t len){
+		std::memcpy(bytes + size, data, len);
+		size += len;
+	}
+};
+
+//frames for a single socket that are queued together (and so usually leave in one sendmsg)
+//payloads larger than FrameHead::INLINE_PAYLOAD are referenced, not copied, until append_to()
+class FrameBatch {
+public:
+	void add(uint8_t type, const void* payload, uint32_t payload_len){
+		Entry e{FrameHead(type, payload_len), nullptr, 0};
+		if (payload_len <= FrameHead::INLINE_PAYLOAD){
+			if (payload_len > 0){
+				e.head.put(payload, payload_len);
+			}
+		} else {
+			e.payload = payload;
+			e.len = payload_len;
+		}
+		entries_.push_back(e);
+	}
+
+	//header of a frame whose body is queued separately by the caller (PIECE via sendfile)
+	void add_head(uint8_t type, uint32_t payload_len, const void* prefix, uint32_t prefix_len){
+		Entry e{FrameHead(type, payload_len), nullptr, 0};
+		e.head.put(prefix, prefix_len);
+		entries_.push_back(e);
+	}
+
+	bool empty() const { return entries_.empty(); }
+	void clear() { entries_.clear(); }
+
+	//serializes every frame onto the end of out and empties the batch
+	void append_to(std::vector<char>& out){
+		for (auto& e : entries_){
+			out.insert(out.end(), e.head.bytes, e.head.bytes + e.head.size);
+			if (e.len > 0){
+				const char* p = static_cast<const char*>(e.payload);
+				out.insert(out.end(), p, p + e.len);
+			}
+		}
+		entries_.clear();
+	}
+
+private:
+	struct Entry {
+		FrameHead head;
+		const void* payload;
+		uint32_t len;
+	};
+	std::vector<Entry> entries_;
+};
+
+//one parsed frame, the payload points into the receive buffer it came from
+struct FrameView {
+	uint8_t type;
+	std::span<const char> payload;
+};
+
+//per-connection receive buffer: a single recv() takes as much as the socket has queued and every
+//complete frame in it is parsed in place. only the unfinished tail is ever moved, back to the front,
+//when the buffer runs out of room. views handed out by next() are valid until the following fill()
+class RecvBuffer {
+public:
+	static const size_t DEFAULT_CAPACITY = 64 * 1024;
+	static const size_t MIN_READ = 4096; //compact rather than recv() into less space than this
+	static const size_t DEFAULT_MAX_FRAME = 16 * 1024 * 1024;
+
+	RecvBuffer() : buf_(DEFAULT_CAPACITY){}
+
+	//longest frame (length field) accepted, anything larger is treated as malformed before the buffer
+	//grows for it, so a bogus length can't make us allocate gigabytes
+	void set_max_frame(size_t max_frame){ max_frame_ = max_frame; }
+
+	//1 => read some bytes, 0 => nothing available, -1 => connection closed or failed
+	//full is set when the read filled all free space (the socket may have more)
+	int fill(int sock, bool& full){
+		full = false;
+		if (head_ == tail_){
+			head_ = tail_ = 0;
+		}
+
+		size_t need = need_ > 5 ? need_ : 5;
+		if (need > buf_.size()){
+			std::vector<char> bigger(need);
+			std::memcpy(bigger.data(), buf_.data() + head_, tail_ - head_);
+			tail_ -= head_;
+			head_ = 0;
+			buf_.swap(bigger);
+		} else if (buf_.size() - head_ < need || buf_.size() - tail_ < MIN_READ){
+			std::memmove(buf_.data(), buf_.data() + head_, tail_ - head_);
+			tail_ -= head_;
+			head_ = 0;
+		}
+
+		size_t space = buf_.size() - tail_;
+		while (true){
+			ssize_t r = recv(sock, buf_.data() + tail_, space, MSG_DONTWAIT);
+			if (r == 0){
+				return -1;
+			}
+			if (r < 0){
+				if (errno == EINTR){
+					continue;
+				}
+				return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+			}
+			tail_ += static_cast<size_t>(r);
+			full = static_cast<size_t>(r) == space;
+			return 1;
+		}
+	}
+
+	//1 => out holds the next frame, 0 => the next frame is incomplete, -1 => malformed length
+	int next(FrameView& out){
+		size_t avail = tail_ - head_;
+		if (avail < 5){
+			return 0;
+		}
+		uint32_t nlen = 0;
+		std::memcpy(&nlen, buf_.data() + head_, 4);
+		uint32_t length = ntohl(nlen);
+		if (length < 1 || length > max_frame_){
+			return -1;
+		}
+		if (avail - 4 < length){
+			need_ = 4 + static_cast<size_t>(length);
+			return 0;
+		}
+		out.type = static_cast<uint8_t>(buf_[head_ + 4]);
+		out.payload = std::span<const char>(buf_.data() + head_ + 5, length - 1);
+		head_ += 4 + static_cast<size_t>(length);
+		need_ = 0;
+		return 1;
+	}
+
+private:
+	std::vector<char> buf_;
+	size_t head_ = 0; //first byte not yet parsed
+	size_t tail_ = 0; //one past the last byte received
+	size_t need_ = 0; //size of the frame waiting to complete (0 if unknown)
+	size_t max_frame_ = DEFAULT_MAX_FRAME;
+};
@@ -4,7 +4,10 @@
 #include <cstdint>
 #include <cstring>
 #include <vector>
+#include <cerrno>
+#include <unistd.h>
 #include<sys/socket.h>
+#include <arpa/inet.h>
 
 struct handshake_header {
 	std::array<char,18> header;
@@ -32,47 +35,17 @@ enum : uint8_t {
 	PIECE = 0x05,
 	HAVE = 0x06,
 	BITFIELD = 0x07,
+	CANCEL = 0x08, //same payload as the REQUEST it withdraws, only sent with EXT_CANCEL
 };
 
-//helper function for reading from recv
-static bool read_exact(int sock, void* buf, size_t size){
-	char* m_buf = static_cast<char*>(buf);
-	size_t chars_left = size;
-
-	while (chars_left > 0){
-		ssize_t r = recv(sock, m_buf, chars_left, 0);
-		if (r == 0) {
-			return false; //peers connection closed
-		}
-		if (r < 0){
-			if (errno == EINTR){ //connection interrupted
-				continue;
-			}
-			return false;
-		}
-		m_buf += r; //move pointer forward
-		chars_left -= static_cast<size_t>(r);
-	}
-	return true;
-}
-
-static bool send_exact(int sock, const void* buf, size_t size){
-	const char* m_buf = static_cast<const char*>(buf);
-	size_t chars_left = size;
-
-	while (chars_left > 0){
-		ssize_t s = send(sock, m_buf, chars_left, 0);
-		if (s <= 0){
-			if (s < 0 && errno == EINTR){
-				continue;
-			}
-			return false;
-		}
-		m_buf += s;
-		chars_left -= static_cast<size_t>(s);
-	}
-	return true;
-}
+//extension flags carried in the last reserved handshake byte
+//a flag only takes effect when both ends set it, plain peers send zeros and get the original protocol
+enum : uint8_t {
+	EXT_PIPELINING = 0x01, //several REQUESTs may be outstanding at once
+	EXT_BLOCKS = 0x02, //REQUEST is index+begin+length and PIECE is index+begin+data
+	EXT_CANCEL = 0x04, //CANCEL is understood, without it requests we no longer want are left to arrive
+};
+static const size_t HANDSHAKE_EXT_BYTE = 27;
 
 static int ceiling_divide(unsigned int a, unsigned int b){
 	if (a == 0){
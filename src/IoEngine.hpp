@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include "IoUring.hpp"
+
+enum class IoBackend {
+	Posix, //plain blocking syscalls, one per operation
+	Uring, //io_uring with the piece file registered up front
+};
+
+//one positional read or write of the piece file inside a batch
+struct FileOp {
+	bool write;
+	void* buf;
+	size_t len;
+	uint64_t offset;
+	bool ok = false;
+};
+
+//batches piece file I/O into as few syscalls as the backend allows
+//
+//with io_uring the ops of every thread that comes in while a batch is in the kernel are queued, and
+//the next thread to get the ring submits all of them with one io_uring_enter. so N disk threads
+//writing at once cost one syscall instead of N, and nobody waits on a lock held across a single op.
+//ops go straight from the caller's buffers. without io_uring it is a syscall per op
+class IoEngine {
+public:
+	explicit IoEngine(IoBackend requested);
+	~IoEngine();
+
+	IoEngine(const IoEngine&) = delete;
+	IoEngine& operator=(const IoEngine&) = delete;
+
+	//the backend actually in use (Posix if io_uring was requested but is unavailable)
+	IoBackend backend() const { return backend_; }
+	bool uring() const { return backend_ == IoBackend::Uring; }
+
+	//registers the piece file, must be called before any file op
+	bool attach_file(int fd);
+
+	//thread safe, returns once every op is done
+	void file_batch(std::vector<FileOp>& ops);
+
+	bool read_file(void* buf, size_t len, uint64_t offset);
+	bool write_file(const void* buf, size_t len, uint64_t offset);
+
+private:
+	void uring_file_batch(std::vector<FileOp>& ops);
+	//submits the ops of every waiting caller, only one thread at a time (submitting_)
+	void submit(std::vector<FileOp*>& ops);
+	//collects exactly count completions, results are indexed by user_data
+	bool reap(std::vector<int32_t>& results, unsigned int count);
+
+	IoBackend backend_;
+	IoUring* ring_ = nullptr;
+
+	int file_fd_ = -1;
+	bool file_registered_ = false;
+
+	//callers whose ops wait for the next submission
+	struct Waiter {
+		std::vector<FileOp>* ops;
+		bool done;
+	};
+	std::vector<Waiter*> waiting_;
+	bool submitting_ = false; //some thread owns the ring right now
+	std::mutex mu_;
+	std::condition_variable done_cv_;
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+//minimal io_uring wrapper on top of the raw syscalls (no liburing dependency)
+//not thread safe, the owner serializes access
+class IoUring {
+public:
+	IoUring() = default;
+	~IoUring();
+
+	IoUring(const IoUring&) = delete;
+	IoUring& operator=(const IoUring&) = delete;
+
+	//false if the kernel has no io_uring (or it is blocked)
+	bool init(unsigned int entries);
+	bool ready() const { return ring_fd_ >= 0; }
+
+	//true if the kernel knows every opcode in the list
+	bool supports(const uint8_t* ops, size_t count);
+
+	bool register_files(const int* fds, unsigned int count);
+
+	//nullptr when the submission queue is full
+	io_uring_sqe* get_sqe();
+
+	//submits everything queued and waits until wait_nr completions are available
+	int submit_and_wait(unsigned int wait_nr);
+
+	//pops one completion, false if none are ready
+	bool pop_cqe(uint64_t& user_data, int32_t& res);
+
+	unsigned int sq_entries() const { return sq_entries_; }
+
+private:
+	int ring_fd_ = -1;
+
+	void* sq_ptr_ = nullptr;
+	size_t sq_len_ = 0;
+	void* cq_ptr_ = nullptr;
+	size_t cq_len_ = 0;
+	io_uring_sqe* sqes_ = nullptr;
+	size_t sqes_len_ = 0;
+
+	unsigned int* sq_head_ = nullptr;
+	unsigned int* sq_tail_ = nullptr;
+	unsigned int* sq_mask_ = nullptr;
+	unsigned int* sq_array_ = nullptr;
+	unsigned int sq_entries_ = 0;
+	unsigned int pending_ = 0; //sqes queued but not yet submitted
+
+	unsigned int* cq_head_ = nullptr;
+	unsigned int* cq_tail_ = nullptr;
+	unsigned int* cq_mask_ = nullptr;
+	io_uring_cqe* cqes_ = nullptr;
+};
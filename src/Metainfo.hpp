@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+#include "Sha256.hpp"
+
+class WorkerPool;
+
+//per-piece SHA-256 digests of the shared file, generated by a seed as <FileName>.meta next to Common.cfg
+//
+//layout (host byte order): magic[8] file_size:u64 piece_size:u64 total_pieces:u32 then one
+//32 byte digest per piece
+class Metainfo {
+public:
+	Metainfo(size_t file_size, size_t piece_size, int total_pieces);
+
+	//reads the digests, false if the file is missing or describes a different file layout
+	bool load(const std::string& path);
+
+	//hashes every piece of data_fd (spread over pool) and writes the result to path (written aside and renamed)
+	bool generate(int data_fd, const std::string& path, WorkerPool& pool);
+
+	bool loaded() const { return !digests_.empty(); }
+
+	bool verify(int piece_index, std::span<const char> piece_data) const;
+
+private:
+	size_t piece_length(int piece_index) const;
+
+	size_t file_size_;
+	size_t piece_size_;
+	int total_pieces_;
+	std::vector<sha256::Digest> digests_;
+};
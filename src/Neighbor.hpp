@@ -5,139 +5,313 @@
 #include <cstdint>
 #include <cstring>
 #include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
 #include <unistd.h>
+#include "Frame.hpp"
+#include "OutQueue.hpp"
+#include "Bitfield.hpp"
+#include "NeighborTable.hpp"
 
+//one outstanding REQUEST, begin/length cover the whole piece unless EXT_BLOCKS is in use
+struct PendingRequest {
+	int piece;
+	uint32_t begin;
+	uint32_t length;
+	std::chrono::steady_clock::time_point sent;
+	std::chrono::steady_clock::time_point deadline; //given up on (and released) after this
+};
+
+//one connected peer. created by (and living in a slot of) a NeighborTable, which holds its hot fields:
+//peer id, choke/interest flags, download rate and in-flight count. the rest is kept here
 class Neighbor{
+public:
+	static constexpr double INITIAL_REQUEST_TIMEOUT = 20.0; //seconds, before we know their rate
+	static constexpr double MIN_REQUEST_TIMEOUT = 2.0;
+	static const size_t MAX_WITHDRAWN = 64; //withdrawn requests remembered, the oldest are forgotten first
+
 private:
-	uint16_t port_; // we cant make this const because we have to change it to -1 in assignment operator
+	NeighborTable& table_;
+	int slot_;
+
+	uint16_t port_;
 
 	int sock_;
 	int num_pieces_;
 	std::string ip_;
 	bool has_file_;
 
-	int peer_id_;
-	bool choked_;
-	bool interested_;
-	std::vector<uint8_t> bitfield_;//stores a byte per index
+	uint8_t extensions_; //handshake extensions both sides advertised
+	Bitfield bitfield_; //pieces they have
+
+	std::vector<PendingRequest> in_flight_; //requests sent to this neighbor that have not been answered yet
+	std::vector<PendingRequest> withdrawn_; //cancelled, expired or choked requests whose PIECE may still be on the way
+	double min_latency_; //seconds, quickest request->piece time seen (slowly forgotten)
+	std::chrono::steady_clock::time_point last_arrival_;
+
+	RecvBuffer inbox_; //bytes received but not yet dispatched (socket is non-blocking)
+	OutQueue* outbox_; //bytes waiting for the socket to become writable
+	std::vector<PendingRequest> deferred_; //their REQUESTs held back while outbox_ is congested
 
 public:
-	Neighbor(int sock, uint16_t port, std::string ip, int peer_id, bool has_file)
-		: sock_(sock), 
-		port_(port), 
+	Neighbor(NeighborTable& table, int slot, int sock, uint16_t port, std::string ip, bool has_file)
+		: table_(table),
+		slot_(slot),
+		port_(port),
+		sock_(sock),
+		num_pieces_(0),
 		ip_(std::move(ip)),
-		peer_id_(peer_id),
-		choked_(true),
-		interested_(false),
-		has_file_(has_file){}
+		has_file_(has_file),
+		extensions_(0),
+		min_latency_(0.0),
+		outbox_(new OutQueue()){}
 
 	~Neighbor() {
 		if (sock_ >= 0){
 			close(sock_);
 			sock_ = -1;
 		}
+		delete outbox_;
 	}
 
 	// this is only here because we probably shouldn't copy neighbors
 	// if you copy a neighbor it will attempt to close the same socket twice
-	
+	//a neighbor is tied to its table slot, so it can't be moved either
 	Neighbor(const Neighbor&) = delete;
 	Neighbor& operator = (const Neighbor&) = delete;
 
-	//move
-	//this looks terrible but it just allows for moving a neighbor to another variable without the possibility of closing the same socket twice
-	//ie makes it harder to shoot yourself in the foot
-	Neighbor(Neighbor&& other) noexcept
-		:port_(other.port_),
-		sock_(other.sock_),
-		ip_(other.ip_),
-		peer_id_(other.peer_id_),
-		num_pieces_(other.num_pieces_),
-		choked_(other.choked_),
-		interested_(other.interested_),
-		has_file_(other.has_file_),
-		bitfield_(std::move(other.bitfield_)){
-		
-		other.sock_ = -1;
-		other.port_ = 0;
-		other.ip_ = "";
-		other.peer_id_ = 0;
-		other.num_pieces_ = 0;
-		other.choked_ = true;
-		other.interested_ = false;
-		other.has_file_ = false;
-	}
-
-	//overrights assignment operator (again so that we dont shoot ourselves in the foot c++ :D)
-	
-	Neighbor& operator=(Neighbor&& other) noexcept {
-		if (this != &other) {
-			if (sock_ >= 0) {
-				close(sock_);
-			}
-			port_ = other.port_;
-			sock_ = other.sock_;
-			num_pieces_ = other.num_pieces_;
-			ip_ = std::move(other.ip_);
-			peer_id_ = other.peer_id_;
-			choked_ = other.choked_;
-			interested_ = other.interested_;
-			has_file_ = other.has_file_;
-			bitfield_ = std::move(other.bitfield_);
-			other.sock_ = -1;
-			other.port_ = 0;
-			other.num_pieces_ = 0;
-			other.choked_ = true;
-			other.interested_ = false;
-			other.has_file_ = false;
-		}
-		return *this;
-	}
-	
 	//getters
 	int sock() const { return sock_;}
 	uint16_t port() const {return port_;}
-	bool choked() const { return choked_; }
-	bool interested() const { return interested_; }
-	std::vector<uint8_t> bitfield() const { return bitfield_; }
+	int slot() const { return slot_; }
+	bool choked() const { return table_.choked_[slot_] != 0; }
+	bool interested() const { return table_.interested_[slot_] != 0; }
+	bool peer_choking() const { return table_.peer_choking_[slot_] != 0; }
+	bool am_interested() const { return table_.am_interested_[slot_] != 0; }
+	double rate() const { return table_.rate_[slot_]; }
+	uint8_t extensions() const { return extensions_; }
+	bool supports(uint8_t ext) const { return (extensions_ & ext) != 0; }
+	const Bitfield& pieces() const { return bitfield_; }
 	bool has_file(){ return has_file_; }
-	uint32_t peer_id(){return peer_id_;}
-	std::vector<uint8_t>& get_bitfield() { return bitfield_; }
+	uint32_t peer_id() const {return table_.peer_id_[slot_];}
+
+	//byte counts for the choking round, from any thread
+	void add_received(size_t bytes){
+		table_.down_bytes_[slot_].fetch_add(bytes, std::memory_order_relaxed);
+		mark_active();
+	}
+	//they unchoked us, sent data, or we start waiting on them again: the snub clock starts over
+	void mark_active(){
+		table_.last_active_[slot_].store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+	}
+	void add_sent(size_t bytes){ table_.up_bytes_[slot_].fetch_add(bytes, std::memory_order_relaxed); }
+	RecvBuffer& inbox() { return inbox_; }
+	OutQueue& outbox() { return *outbox_; }
+
+	//REQUESTs we will answer once the outbox has room again. they wait as long as it takes, no deadline
+	void defer_request(int piece_index, uint32_t begin, uint32_t length){
+		deferred_.push_back(PendingRequest{piece_index, begin, length, std::chrono::steady_clock::now(),
+			std::chrono::steady_clock::time_point::max()});
+	}
+	std::vector<PendingRequest> take_deferred(){
+		std::vector<PendingRequest> out;
+		out.swap(deferred_);
+		return out;
+	}
+	//they withdrew a request we are holding back, false if it isn't here
+	bool cancel_deferred(int piece_index, uint32_t begin){
+		return std::erase_if(deferred_, [&](const PendingRequest& r){ return r.piece == piece_index && r.begin == begin; }) != 0;
+	}
 
 	//setters
-	void set_interested(bool val){ this->interested_ = val;}
-	void set_choked(bool val){ this->choked_ = val; }
+	void set_interested(bool val){ table_.interested_[slot_] = val;}
+	void set_choked(bool val){ table_.choked_[slot_] = val; }
 	void set_has_file(bool val){ this->has_file_ = val;}
+	void set_peer_choking(bool val){ table_.peer_choking_[slot_] = val; }
+	void set_am_interested(bool val){ table_.am_interested_[slot_] = val; }
+	void set_extensions(uint8_t val){ this->extensions_ = val; }
 
-	void set_piece(int piece_index, bool value){
-		size_t byte = piece_index / 8;
-		size_t bit = 7 - (piece_index % 8);
+	//request tracking, only touched from the reactor thread that owns this neighbor's socket
+private:
+	void withdraw(const PendingRequest& r){
+		if (withdrawn_.size() == MAX_WITHDRAWN){
+			withdrawn_.erase(withdrawn_.begin());
+		}
+		withdrawn_.push_back(r);
+	}
+public:
+	size_t in_flight() const { return in_flight_.size(); }
+	const std::vector<PendingRequest>& requests() const { return in_flight_; }
+	void clear_requests(){
+		for (const auto& r : in_flight_){
+			withdraw(r);
+		}
+		in_flight_.clear();
+		table_.in_flight_[slot_] = 0;
+	}
 
-		if (byte >= bitfield_.size()){
-			return;
+	//a PIECE that answers a request we withdrew (returned in request) is still ours to use, anything
+	//else was never asked for
+	bool take_withdrawn(int piece_index, uint32_t begin, PendingRequest& request){
+		for (auto it = withdrawn_.begin(); it != withdrawn_.end(); ++it){
+			if (it->piece == piece_index && it->begin == begin){
+				request = *it;
+				withdrawn_.erase(it);
+				return true;
+			}
 		}
+		return false;
+	}
 
-		if (value){
-			bitfield_[byte] |= (1 << bit);
-		} else {
-			bitfield_[byte] &= ~(1 << bit);
+	bool is_requested(int piece_index) const {
+		for (const auto& r : in_flight_){
+			if (r.piece == piece_index){
+				return true;
+			}
 		}
+		return false;
+	}
+
+	bool is_requested(int piece_index, uint32_t begin) const {
+		for (const auto& r : in_flight_){
+			if (r.piece == piece_index && r.begin == begin){
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//forgets our request for the block (someone else delivered it), false if there was none
+	bool cancel_request(int piece_index, uint32_t begin, PendingRequest& cancelled){
+		for (auto it = in_flight_.begin(); it != in_flight_.end(); ++it){
+			if (it->piece == piece_index && it->begin == begin){
+				cancelled = *it;
+				withdraw(*it);
+				in_flight_.erase(it);
+				table_.in_flight_[slot_] = static_cast<uint32_t>(in_flight_.size());
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void on_request_sent(int piece_index, uint32_t begin, uint32_t length){
+		auto now = std::chrono::steady_clock::now();
+		auto timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(request_timeout(length)));
+		if (in_flight_.empty()){
+			mark_active(); //we weren't waiting on them before, idle time is no snub
+		}
+		in_flight_.push_back(PendingRequest{piece_index, begin, length, now, now + timeout});
+		table_.in_flight_[slot_] = static_cast<uint32_t>(in_flight_.size());
+	}
+
+	//how long a new request of length bytes may go unanswered: four times what it should take at the
+	//measured rate, behind everything already in flight, plus the latency
+	double request_timeout(uint32_t length) const {
+		double rate = table_.rate_[slot_];
+		if (rate <= 0.0){
+			return INITIAL_REQUEST_TIMEOUT;
+		}
+		double queued = static_cast<double>(length);
+		for (const auto& r : in_flight_){
+			queued += r.length;
+		}
+		return std::max(MIN_REQUEST_TIMEOUT, 4.0 * (min_latency_ + queued / rate));
 	}
-	
-	bool has_piece(int piece_index) const{
-		size_t byte = piece_index / 8;
-		size_t bit = 7 - (piece_index % 8);
 
-		if (byte >= bitfield_.size()){
+	//removes and returns the requests whose deadline passed. their rate estimate is halved, so the
+	//window shrinks and the next deadlines are further out
+	std::vector<PendingRequest> take_expired(std::chrono::steady_clock::time_point now){
+		std::vector<PendingRequest> expired;
+		for (auto it = in_flight_.begin(); it != in_flight_.end();){
+			if (it->deadline <= now){
+				expired.push_back(*it);
+				withdraw(*it);
+				it = in_flight_.erase(it);
+			} else {
+				++it;
+			}
+		}
+		if (!expired.empty()){
+			table_.rate_[slot_] *= 0.5;
+			table_.in_flight_[slot_] = static_cast<uint32_t>(in_flight_.size());
+		}
+		return expired;
+	}
+
+	//feeds the rate/latency estimates, false if we never asked this neighbor for the block (otherwise
+	//the request it answers is returned in request)
+	bool on_piece_received(int piece_index, uint32_t begin, size_t bytes, PendingRequest& request){
+		auto now = std::chrono::steady_clock::now();
+		auto it = in_flight_.begin();
+		while (it != in_flight_.end() && (it->piece != piece_index || it->begin != begin)){
+			++it;
+		}
+		if (it == in_flight_.end()){
 			return false;
 		}
 
-		unsigned char b = static_cast<unsigned char>(bitfield_[byte]);
-		return ((b >> bit) & 1) != 0;
+		double latency = std::chrono::duration<double>(now - it->sent).count();
+		bool pipe_busy = in_flight_.size() > 1 && last_arrival_.time_since_epoch().count() != 0;
+		//with more requests queued behind this one the gap between arrivals is the transfer time
+		double span = pipe_busy ? std::chrono::duration<double>(now - last_arrival_).count() : latency;
+		if (span > 0){
+			double sample = static_cast<double>(bytes) / span;
+			double& rate = table_.rate_[slot_];
+			rate = (rate == 0.0) ? sample : 0.75 * rate + 0.25 * sample;
+		}
+		if (min_latency_ == 0.0 || latency < min_latency_){
+			min_latency_ = latency;
+		} else {
+			min_latency_ *= 1.05;
+		}
+
+		last_arrival_ = now;
+		request = *it;
+		in_flight_.erase(it);
+		table_.in_flight_[slot_] = static_cast<uint32_t>(in_flight_.size());
+		return true;
+	}
+
+	//how many requests to keep outstanding: one round trip's worth of requests (bandwidth-delay
+	//product) plus the one being transferred. neighbors without pipelining get one at a time
+	//unit_size is the size of one request, a piece or a block
+	size_t request_window(uint8_t pipelining_ext, size_t max_window, size_t unit_size) const {
+		if (!supports(pipelining_ext) || max_window <= 1){
+			return 1;
+		}
+		size_t window = 2;
+		double rate = table_.rate_[slot_];
+		if (rate > 0.0 && min_latency_ > 0.0 && unit_size > 0){
+			double transfer = static_cast<double>(unit_size) / rate;
+			double rtt = std::max(0.0, min_latency_ - transfer);
+			window = static_cast<size_t>(std::ceil(rate * rtt / static_cast<double>(unit_size))) + 1;
+		}
+		return std::clamp(window, static_cast<size_t>(2), max_window);
+	}
+
+	//true if that changed their bitfield
+	bool set_piece(int piece_index, bool value){
+		if (value){
+			return bitfield_.set(piece_index);
+		}
+		return bitfield_.reset(piece_index);
+	}
+	
+	bool has_piece(int piece_index) const{
+		return bitfield_.test(piece_index);
 	}
 
 	void init_bitfield(int num_pieces){
-		bitfield_.resize((num_pieces + 7) / 8, 0x00);
+		bitfield_.assign(num_pieces, false);
+	}
+
+	//takes their BITFIELD message
+	void load_bitfield(int num_pieces, std::span<const char> payload){
+		bitfield_.assign(num_pieces, false);
+		bitfield_.assign_bytes(payload);
 	}
 	
 
@@ -0,0 +1,123 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Neighbor;
+
+//every connected neighbor, found by socket in O(1) (a socket -> slot array) and by peer id through a
+//hash map. a neighbor keeps its slot for as long as it is connected, freed slots are reused
+//
+//the fields the message path and the choking scan look at (choke/interest flags, peer id, download
+//rate, requests in flight) are stored column by column, indexed by slot, so a scan over every neighbor
+//walks a few small contiguous arrays. the Neighbor object keeps the cold state (address, buffers,
+//request list). all columns are sized once up front and never reallocate, so a neighbor's own reactor
+//thread can use its row without a lock while other rows are added or removed
+//
+//emplace()/remove()/by_id() and slot scans from other threads need the caller's lock (peers_mu_),
+//by_sock() from the socket's own thread doesn't
+class NeighborTable {
+public:
+	static const size_t DEFAULT_CAPACITY = 256;
+	static const size_t MAX_SOCK = 65536; //highest socket number a neighbor may have (exclusive)
+
+	explicit NeighborTable(size_t capacity = DEFAULT_CAPACITY);
+	~NeighborTable();
+
+	NeighborTable(const NeighborTable&) = delete;
+	NeighborTable& operator=(const NeighborTable&) = delete;
+
+	//creates and owns a neighbor, nullptr when the table is full or the socket number is out of range
+	Neighbor* emplace(int sock, uint16_t port, std::string ip, uint32_t peer_id, bool has_file);
+	//forgets and deletes the neighbor on sock (closing the socket), false if there is none
+	bool remove(int sock);
+
+	Neighbor* by_sock(int sock) const {
+		if (sock < 0 || static_cast<size_t>(sock) >= slot_of_sock_.size()){
+			return nullptr;
+		}
+		int slot = slot_of_sock_[sock];
+		return slot < 0 ? nullptr : rows_[slot];
+	}
+	Neighbor* by_id(uint32_t peer_id) const;
+
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+	//slots in use are below end_slot(), at() is nullptr for a free one
+	size_t end_slot() const { return end_; }
+	Neighbor* at(size_t slot) const { return rows_[slot]; }
+
+	//hot columns, by slot
+	uint32_t peer_id(size_t slot) const { return peer_id_[slot]; }
+	bool choked(size_t slot) const { return choked_[slot] != 0; }
+	bool interested(size_t slot) const { return interested_[slot] != 0; }
+	double rate(size_t slot) const { return rate_[slot]; }
+	//bytes per second over the last few windows (choking rounds), see sample_rates()
+	double down_rate(size_t slot) const { return down_rate_[slot]; }
+	double up_rate(size_t slot) const { return up_rate_[slot]; }
+	bool peer_choking(size_t slot) const { return peer_choking_[slot] != 0; }
+	bool am_interested(size_t slot) const { return am_interested_[slot] != 0; }
+	std::chrono::steady_clock::time_point connected_at(size_t slot) const { return connected_[slot]; }
+	//they unchoked us and have our requests, but nothing came for timeout
+	bool snubbed(size_t slot, std::chrono::steady_clock::time_point now, std::chrono::steady_clock::duration timeout) const {
+		if (peer_choking(slot) || !am_interested(slot) || in_flight_[slot] == 0){
+			return false;
+		}
+		auto last = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(last_active_[slot].load(std::memory_order_relaxed)));
+		return now - last > timeout;
+	}
+	uint32_t in_flight(size_t slot) const { return in_flight_[slot]; }
+	//requests we have out, over every neighbor
+	size_t total_in_flight() const {
+		size_t total = 0;
+		for (size_t s = 0; s < end_; ++s){
+			total += in_flight_[s];
+		}
+		return total;
+	}
+
+	//closes a sample of seconds: the bytes counted since the last call become a sample of each
+	//neighbor's download and upload rate, and the counters start over. the rates are an EWMA whose
+	//weights only depend on time: a window's worth of samples counts 0.6, the rest 0.4, however
+	//often it is sampled
+	void sample_rates(double seconds, double window);
+
+	template <class F>
+	void for_each(F f) const {
+		for (size_t s = 0; s < end_; ++s){
+			if (rows_[s] != nullptr){
+				f(rows_[s]);
+			}
+		}
+	}
+
+private:
+	friend class Neighbor;
+
+	std::vector<Neighbor*> rows_;
+	std::vector<int> slot_of_sock_;
+	std::unordered_map<uint32_t, int> slot_of_id_;
+	std::vector<int> free_; //free slots below end_
+	size_t end_ = 0;
+	size_t size_ = 0;
+
+	//columns
+	std::vector<uint32_t> peer_id_;
+	std::vector<uint8_t> choked_;        //we are choking them
+	std::vector<uint8_t> interested_;    //they are interested in us
+	std::vector<uint8_t> peer_choking_;  //they are choking us
+	std::vector<uint8_t> am_interested_; //we told them we are interested
+	std::vector<double> rate_;           //download rate from them, bytes per second (EWMA over answered requests)
+	std::vector<std::atomic<uint64_t>> down_bytes_; //received from them this round (reactor threads add)
+	std::vector<std::atomic<uint64_t>> up_bytes_;   //queued for them this round
+	std::vector<double> down_rate_;      //per-round download rate, for choosing preferred neighbors
+	std::vector<double> up_rate_;        //per-round upload rate, seeds may rank by it
+	std::vector<std::atomic<int64_t>> last_active_; //steady clock ticks of their last unchoke or piece
+	std::vector<std::chrono::steady_clock::time_point> connected_;
+	std::vector<uint32_t> in_flight_;    //our requests they haven't answered
+};
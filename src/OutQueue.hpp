@@ -0,0 +1,86 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sys/types.h>
+
+//outbound bytes for one connection. producers on any thread only append (under the queue lock,
+//never touching the socket); flush() writes whatever the non-blocking socket takes and keeps the rest
+//for the next EPOLLOUT. PIECE bodies are queued by reference: a file range spliced with sendfile,
+//or a range of a memory-mapped file sent straight from the mapping, or part of a cached piece
+//
+//two priority classes: control frames (CHOKE, HAVE, REQUEST...) overtake every bulk frame that has
+//not started yet. a frame already partly on the wire has to finish first, so bulk data goes out in
+//slices and control frames slip in at the next frame boundary (every block with EXT_BLOCKS)
+class OutQueue {
+public:
+	static const size_t DEFAULT_LIMIT = 2 * 1024 * 1024;
+	static const size_t SEND_SLICE = 64 * 1024;    //bulk bytes per sendfile call
+	static const size_t FLUSH_BUDGET = 256 * 1024; //bulk bytes per flush, then other sockets get a turn
+
+	enum class Status {
+		Drained, //everything queued is on the wire
+		Pending, //the socket is full, the rest waits for EPOLLOUT
+		Failed,  //the connection is broken, nothing more will be sent
+	};
+
+	//called with true when the queue needs EPOLLOUT and false once it has drained (under the queue lock)
+	using WriteInterest = std::function<void(bool)>;
+
+	explicit OutQueue(size_t limit = DEFAULT_LIMIT) : limit_(limit){}
+
+	OutQueue(const OutQueue&) = delete;
+	OutQueue& operator=(const OutQueue&) = delete;
+
+	void set_limit(size_t limit);
+	void set_write_interest(WriteInterest cb);
+
+	//appends complete control frames (copied), false once the connection has failed
+	bool push(std::vector<char> bytes);
+	//appends a bulk frame whose body (len bytes at offset) is read from file_fd when it is sent
+	bool push_file(std::vector<char> head, int file_fd, off_t offset, size_t len);
+	//appends a bulk frame whose body is len bytes of memory that outlives the queue (a file mapping)
+	bool push_mapped(std::vector<char> head, const char* body, size_t len);
+	//appends a bulk frame whose body is len bytes of owner starting at begin, owner is kept alive until sent
+	bool push_shared(std::vector<char> head, std::shared_ptr<const std::vector<char>> owner, size_t begin, size_t len);
+
+	//forgets bulk frames that haven't started (we choked the neighbor), returns the bytes dropped
+	size_t discard_bulk();
+	//forgets the first bulk frame with this header if it hasn't started (the request was cancelled)
+	bool discard_unsent(const std::vector<char>& head);
+
+	Status flush(int sock);
+
+	size_t queued() const;
+	//backpressure: over the byte limit, callers should hold off adding bulk data
+	bool congested() const;
+
+private:
+	struct Entry {
+		std::vector<char> bytes; //frame header, or whole frames
+		int file_fd = -1;        //body spliced from this file after bytes (-1 => none)
+		off_t offset = 0;
+		const char* mapped = nullptr; //or sent from this memory instead
+		std::shared_ptr<const std::vector<char>> owner; //keeps mapped valid when it points into a cached piece
+		size_t body_len = 0;
+		size_t sent = 0;         //progress through bytes, then through the body
+	};
+
+	void arm();
+	Status send_control(int sock);
+	//sends until the entry is done, the socket is full or budget (file bytes) runs out
+	Status send_entry(int sock, Entry& e, size_t& budget);
+
+	std::deque<Entry> control_;
+	std::deque<Entry> bulk_;
+	size_t queued_ = 0; //bytes not yet written, file ranges included
+	size_t limit_;
+	bool armed_ = false;
+	bool failed_ = false;
+	WriteInterest on_interest_;
+	mutable std::mutex mu_;
+};
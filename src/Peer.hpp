@@ -6,14 +6,29 @@
 #include <cstring>
 #include <mutex>
 #include "Neighbor.hpp"
+#include "NeighborTable.hpp"
 #include "Header.hpp"
+#include "Frame.hpp"
 #include "logger.hpp"
+#include "Reactor.hpp"
+#include "IoEngine.hpp"
+#include "PieceAssembler.hpp"
+#include "PiecePicker.hpp"
+#include "SuperSeeder.hpp"
+#include "PieceStore.hpp"
+#include "PieceCache.hpp"
+#include "BufferPool.hpp"
+#include "Bitfield.hpp"
+#include "Metainfo.hpp"
+#include "WorkerPool.hpp"
+#include "TimerWheel.hpp"
 #include <thread>
 #include <atomic>
 #include <unordered_map>
 #include <set>
-#include <fstream>
+#include <random>
 #include<iostream>
+#include <fcntl.h>
 
 //helper struct for initializing clients neighbors
 struct InitNeighborInfo {
@@ -23,9 +38,47 @@ struct InitNeighborInfo {
 	uint16_t port;
 };
 
+//how a peer with the complete file picks its preferred neighbors (nobody uploads to it to rank them by)
+enum class SeedChoking {
+	Random, //a random selection of the interested neighbors every round
+	Upload, //the ones that took the most data from us last rounds
+};
+
+//optional tuning knobs (all have sane defaults, see Common.cfg)
+struct PeerOptions {
+	unsigned int reactor_threads = 0; //0 => one event loop per core
+	IoBackend io_backend = IoBackend::Posix;
+	bool pipelining = false; //advertise EXT_PIPELINING in the handshake
+	unsigned int max_outstanding_requests = 16; //upper bound for the adaptive request window
+	bool block_transfers = false; //advertise EXT_BLOCKS in the handshake
+	unsigned int block_size = 16384; //bytes per block request with EXT_BLOCKS
+	size_t send_queue_limit = OutQueue::DEFAULT_LIMIT; //queued bytes per neighbor before we stop answering REQUESTs
+	StoreOptions store; //storage mode, mmap hints and flush policy of the data file
+	bool verify_pieces = true; //check received pieces against the seed's SHA-256 digests
+	unsigned int verify_threads = 0; //hashing threads, 0 => one per core
+	unsigned int disk_threads = 2; //threads writing received pieces
+	size_t disk_queue_depth = 64; //received pieces not yet on disk before we stop sending REQUESTs
+	size_t cache_size = 16 * 1024 * 1024; //memory for cached pieces we serve, 0 => always read from disk
+	unsigned int read_ahead = 2; //pieces read into the cache ahead of a neighbor's requests
+	PickPolicy pick_policy = PickPolicy::RarestFirst; //which missing piece to request next
+	bool endgame = true; //ask for the last pieces from every neighbor that has them, CANCEL the extra copies
+	bool cancel_messages = false; //advertise EXT_CANCEL in the handshake
+	SeedChoking seed_choking = SeedChoking::Random;
+	unsigned int optimistic_unchoking_interval = 10; //seconds between optimistic unchoke rotations
+	unsigned int snub_timeout = 60; //seconds an unchoking neighbor may send nothing before it loses its slot
+	bool super_seeding = false; //starting with the file: reveal pieces one at a time until the swarm has them all
+};
+
 class P2P_Client {
 
 private:
+	static const unsigned int REQUEST_CHECK_MS = 500; //how often requests are checked for their deadline
+	static const unsigned int RATE_SAMPLE_MS = 1000; //how often the byte counters become rate samples
+	static const unsigned int RECONNECT_MIN_S = 1; //first retry after a failed connect, doubled up to RECONNECT_MAX_S
+	static const unsigned int RECONNECT_MAX_S = 60;
+	static const unsigned int MAX_STORE_FAILURES = 8; //piece writes failing in a row before requests are paused
+	static const unsigned int STORE_RETRY_S = 10; //how long they are paused before we try again
+
 	uint16_t port_;
 	int listening_sock_;
 	unsigned int num_pref_neighbors_;
@@ -40,43 +93,82 @@ private:
 
 	bool debug_ = false;
 
-	std::unordered_map<uint32_t, size_t> bytes_downloaded_from_;
-	std::unordered_map<uint32_t, std::chrono::steady_clock::time_point> last_download_time_;
-
-	//piece tracking
-	std::set<int> requested_pieces_;
-	std::unordered_map<int, uint32_t> piece_to_peer_; //which peer requested which piece
-
 	std::set<uint32_t> preferred_neighbors_;
-	uint32_t optimistic_neighbor_;
-
-	std::thread unchoke_thread_;
-	std::thread optimistic_unchoke_timer_;
-	std::vector<std::thread> peer_threads_;
-
-	std::fstream file_;
-	mutable std::mutex file_mu_;
+	std::chrono::steady_clock::time_point last_sample_ = std::chrono::steady_clock::now(); //closes the next rate sample
+	std::minstd_rand choke_rng_{std::random_device{}()}; //breaks ties between equal rates
+	uint32_t optimistic_neighbor_ = 0; //unchoked regardless of rate, rotated every optimistic interval
+	bool has_optimistic_ = false;
+	std::set<uint32_t> snubbed_; //unchoked us but sent nothing for snub_timeout, ranked last
+
+	TimerWheel* timers_ = nullptr; //choking rounds, optimistic rotation, request deadlines, rate samples, reconnects
+	WorkerPool* connect_pool_ = nullptr; //reconnect attempts block in connect(), they don't run on the timer thread
+	std::unordered_map<uint32_t, TimerWheel::TimerId> reconnects_; //neighbors we retry, by peer id (peers_mu_)
+
+	PeerOptions options_;
+	Reactor* reactor_ = nullptr;
+	IoEngine* io_ = nullptr;
+	PieceStore* store_ = nullptr; //the data file (sendfile source and io_uring registered file)
+	PieceAssembler* assembler_ = nullptr; //pieces being downloaded in blocks
+	PiecePicker* picker_ = nullptr; //piece availability across neighbors, chooses what to request and reserves it
+	std::atomic<bool> endgame_{false}; //every missing piece is in flight, duplicates are allowed
+	SuperSeeder* super_seeder_ = nullptr; //what each neighbor has been shown, with SuperSeeding
+	std::atomic<bool> super_seeding_{false}; //our bitfield is hidden, until the swarm holds every piece
+	std::atomic<uint64_t> uploaded_{0}; //piece bytes queued for neighbors since the start
+
+	//piece verification: digests from <FileName>.meta, hashed off the reactor threads
+	WorkerPool* verify_pool_ = nullptr;
+	Metainfo* meta_ = nullptr;
+	std::string meta_path_;
+	std::atomic<bool> meta_ready_{false};
+	std::chrono::steady_clock::time_point meta_last_try_;
+	std::mutex meta_mu_;
+	std::set<int> pending_; //complete pieces waiting for their hash check or their write
+	std::unordered_map<int, std::set<uint32_t>> excluded_; //peers that sent a bad copy of a piece
+	mutable std::mutex pending_mu_;
+
+	//received pieces are written here, the network threads never wait for the disk
+	WorkerPool* disk_pool_ = nullptr;
+	std::atomic<size_t> unstored_{0}; //pieces accepted but not yet written (bounded by disk_queue_depth)
+	std::atomic<unsigned int> store_failures_{0}; //piece writes failed in a row (disk full...), reset by a good one
+	std::atomic<int64_t> store_paused_until_{0}; //steady_clock ticks, no REQUESTs until then (0: not paused)
+	std::atomic<bool> completed_{false}; //the last piece was stored, store_piece runs on several disk threads
+
+	PieceCache* cache_ = nullptr; //hot pieces for serving (not used when pieces are served from a mapping)
+	BufferPool* buffers_ = nullptr; //piece buffers from the receive buffer to the disk, reused
+	size_t max_frame_ = 0; //longest frame a neighbor may send (a PIECE with block header, or the bitfield)
 
 	Logger* logger_;
 
-	std::vector<Neighbor*> neighbors_;
-	std::vector<uint8_t> bitfield_;
+	NeighborTable* neighbors_ = nullptr; //every connected neighbor, by socket and by peer id
+	Bitfield bitfield_; //pieces we have (set on the disk threads, read everywhere)
+
+	std::unordered_map<int, uint8_t> sock_ext_; //extensions agreed in the handshake, until the neighbor exists
 
-	std::unordered_map<uint32_t, bool> neighbor_has_file; //theres got to be a better way to do this
-	std::unordered_map<int, uint32_t> sock_to_peer_;
+	uint8_t extensions_ = 0; //extensions we advertise
 	
 	std::thread accept_thread_;
 	std::atomic<bool> accepting_;
 	std::mutex peers_mu_;
 
 	std::atomic<bool> running_;
-	void unchoke_timer_loop();
+	void start_timers();
+	void sample_rates();
+	void schedule_reconnect(const InitNeighborInfo& info, unsigned int backoff);
+	void reconnect(const InitNeighborInfo& info, unsigned int backoff);
 	void select_preferred_neighbors();
+	void select_optimistic_neighbor();
+	void reveal_next(Neighbor* n);
+	void super_seed_have(Neighbor* n, int piece_index);
+	void reveal_stalled();
+	void end_super_seeding();
+	void choke_neighbor(Neighbor* n);
+	void unchoke_neighbor(Neighbor* n);
 
 	Neighbor* find_neighbor_by_id(uint32_t id);
 	Neighbor* find_neighbor_by_sock(int sock);
 
-	void peer_message_loop(int sock);
+	bool handle_message(int sock, const FrameView& frame);
+	void on_connection_closed(int sock);
 
 	void debug_message(const std::string& msg) const{
 		if (debug_){
@@ -96,7 +188,8 @@ public:
 	    unsigned int piece_size,
 	    bool has_file,
 	    std::vector<InitNeighborInfo> neighbor_info,
-		bool debug = false
+		bool debug = false,
+		PeerOptions options = PeerOptions()
 	    ) 
 		: port_(port),
 		my_peer_id_(peer_id),
@@ -109,63 +202,152 @@ public:
 		file_size_(file_size),
 		piece_size_(piece_size),
 		accepting_(false),
-		debug_(debug) {
+		debug_(debug),
+		options_(options) {
 
 		total_pieces_ = ceiling_divide(file_size_, piece_size_);
+		neighbors_ = new NeighborTable();
+		if (options_.pipelining){
+			extensions_ |= EXT_PIPELINING;
+		}
+		if (options_.block_transfers){
+			extensions_ |= EXT_BLOCKS;
+		}
+		if (options_.cancel_messages){
+			extensions_ |= EXT_CANCEL;
+		}
+		max_frame_ = 9 + std::max<size_t>(piece_size_, (total_pieces_ + 7) / 8);
+		//enough for every piece between the socket and the disk plus a full cache, after that plain allocations
+		size_t pooled = 2 * options_.disk_queue_depth + options_.max_outstanding_requests + options_.cache_size / piece_size_;
+		buffers_ = new BufferPool(piece_size_, pooled);
+		assembler_ = new PieceAssembler(total_pieces_, piece_size_, file_size_, std::min<size_t>(options_.block_size, piece_size_), buffers_);
+		verify_pool_ = new WorkerPool(options_.verify_threads);
+		disk_pool_ = new WorkerPool(options_.disk_threads);
+		connect_pool_ = new WorkerPool(1);
+		meta_ = new Metainfo(file_size_, piece_size_, total_pieces_);
+		meta_path_ = file_name_ + ".meta";
 
 		logger_ = new Logger("log_peer_" + std::to_string(my_peer_id_) + ".log");
 
-		std::cerr << "Peer " << my_peer_id_ << " connecting to neighbors..." << std::endl;
-		
-		for (const auto n : neighbor_info){
-			std::cerr << "Peer " << my_peer_id_ << " connecting to Peer " << n.peerId << " at " << n.host << ":" << n.port << "..." << std::endl;
-			bool success = connect_and_handshake(n.host, n.port, n.peerId, n.hasFile);
-    
-			if (!success) {
-				std::cerr << "WARNING: Failed to connect to peer " << n.peerId 
-						<< " - peer may not be running yet" << std::endl;
-				// Continue anyway - it's okay if some peers aren't ready yet
+		//every connection is serviced by the reactor instead of a thread of its own
+		reactor_ = new Reactor(options_.reactor_threads,
+			[this](int sock){ return read_message(sock); },
+			[this](int sock){ return on_writable(sock); },
+			[this](int sock){ on_connection_closed(sock); });
+		if (!reactor_->start()){
+			throw std::runtime_error("Failed to start event loop");
+		}
+		debug_message("Reactor running with " + std::to_string(reactor_->num_threads()) + " threads");
+
+		io_ = new IoEngine(options_.io_backend);
+		if (options_.io_backend == IoBackend::Uring && !io_->uring()){
+			logger_->event("WARNING", "io_uring is not available, falling back to blocking I/O.");
+		}
+
+		std::string file_path = "peer_" + std::to_string(my_peer_id_) + "/" + file_name_;
+		store_ = new PieceStore(file_path, file_size_, piece_size_, total_pieces_, io_, options_.store);
+		if (!store_->open()){
+			throw std::runtime_error("Failed to open " + file_path);
+		}
+		if (options_.cache_size > 0 && store_->mapped(0) == nullptr){
+			if (options_.cache_size / PieceCache::SHARDS < piece_size_){
+				logger_->event("WARNING", "CacheSize is too small to hold a piece in each of its "
+					+ std::to_string(PieceCache::SHARDS) + " shards, the piece cache is off.");
 			} else {
-				std::cerr << "Successfully connected to peer " << n.peerId << std::endl;
+				cache_ = new PieceCache(options_.cache_size);
 			}
 		}
 
-		std::cerr << "Peer " << my_peer_id_ << " connected to all neighbors." << std::endl;
+		prepare_metainfo();
 
 		std::cerr << "Peer " << my_peer_id_ << " initializing file..." << std::endl;
 
 		//initialize bitfield
 		if (has_file_){
 			//all pieces are set to 1
-			bitfield_.resize((total_pieces_ + 7)/8, 0xFF);
-			int spare = (8 - (total_pieces_ % 8)) % 8;
-
-			if (spare > 0){
-				bitfield_.back() &= (0xFF << spare);
-			}
-
+			bitfield_.assign(total_pieces_, true);
 		} else {
-			bitfield_.resize((total_pieces_ + 7) / 8, 0x00);
+			bitfield_.assign(total_pieces_, false);
 			
-			debug_message("Bitfield resized to " + std::to_string(bitfield_.size()) + " bytes");
-			debug_message("Checking " + std::to_string(total_pieces_) + "pieces...");
+			debug_message("Bitfield resized to " + std::to_string(bitfield_.size()) + " pieces"
+				+ (Bitfield::accelerated() ? " (AVX2)" : ""));
+
+			std::vector<uint8_t> resumed;
+			bool clean = false;
+			if (store_->load_resume(resumed, clean)){
+				bitfield_.assign_bytes(std::span<const uint8_t>(resumed));
+				debug_message(std::string("Piece state restored from the resume file")
+					+ (clean ? "." : ", checking it (the last run didn't shut down cleanly or the file changed since)."));
+				if (!clean && meta_ready_){
+					//a crash or a change to the data file since, the digests tell which pieces still hold
+					std::atomic<int> dropped{0};
+					for (int i = 0; i < total_pieces_; i++){
+						if (has_piece(i)){
+							verify_pool_->submit([this, i, &dropped]{
+								if (!verify_on_disk(i)){
+									set_bitfield_bit(i, false);
+									dropped++;
+								}
+							});
+						}
+					}
+					verify_pool_->wait_idle();
+					if (dropped > 0){
+						logger_->event("WARNING", std::to_string(dropped.load()) + " pieces from the resume file failed verification and will be downloaded again.");
+					}
+				}
+			} else {
+				//no resume file, or it belongs to another file
+				debug_message("Checking " + std::to_string(total_pieces_) + " pieces...");
     
-			// check disk for pieces we might already have
-			for (int i = 0; i < total_pieces_; i++) {
-				if (i % 10 == 0) {  // Every 10th piece
-					debug_message("Checking piece " + std::to_string(i) + "...");
-        		}
-				if (has_piece_on_disk(i)) {
-					set_bitfield_bit(i, true);
+				// check disk for pieces we might already have
+				for (int i = 0; i < total_pieces_; i++) {
+					if (i % 10 == 0) {  // Every 10th piece
+						debug_message("Checking piece " + std::to_string(i) + "...");
+					}
+					if (has_piece_on_disk(i) && verify_on_disk(i)) {
+						set_bitfield_bit(i, true);
+					}
 				}
 			}
 			debug_message("Bitfield initialization complete.");
 		}
+		picker_ = new PiecePicker(bitfield_, options_.pick_policy);
+		if (options_.super_seeding && has_complete_file()){
+			super_seeder_ = new SuperSeeder(total_pieces_, *picker_);
+			super_seeding_ = true;
+			logger_->line("Peer " + std::to_string(my_peer_id_) + " is super-seeding.");
+		}
+		if (!store_->reset_resume(bitfield_.to_bytes())){
+			logger_->event("WARNING", "Could not write the resume file, the next start will check the disk again.");
+		}
+
+		//bitfield has to be ready before the first BITFIELD message goes out
+		std::cerr << "Peer " << my_peer_id_ << " connecting to neighbors..." << std::endl;
+		
+		std::vector<InitNeighborInfo> unreachable;
+		for (const auto n : neighbor_info){
+			std::cerr << "Peer " << my_peer_id_ << " connecting to Peer " << n.peerId << " at " << n.host << ":" << n.port << "..." << std::endl;
+			bool success = connect_and_handshake(n.host, n.port, n.peerId, n.hasFile);
+    
+			if (!success) {
+				std::cerr << "WARNING: Failed to connect to peer " << n.peerId 
+						<< " - peer may not be running yet, retrying in the background" << std::endl;
+				unreachable.push_back(n);
+			} else {
+				std::cerr << "Successfully connected to peer " << n.peerId << std::endl;
+			}
+		}
+
+		std::cerr << "Peer " << my_peer_id_ << " connected to all neighbors." << std::endl;
 
 		std::cerr << "Peer " << my_peer_id_ << " setting up logger." << std::endl;
 	
 		running_ = true;
-		unchoke_thread_ = std::thread(&P2P_Client::unchoke_timer_loop, this);
+		start_timers();
+		for (const auto& n : unreachable){
+			schedule_reconnect(n, RECONNECT_MIN_S);
+		}
 
 		debug_message("Peer " + std::to_string(my_peer_id_) + " about to start listening on port " + std::to_string(port_) + "...");
 		int listen_result = start_listening();
@@ -180,30 +362,82 @@ public:
 	}
 	~P2P_Client() {
 		running_ = false;
+
+		// stop accepting first, accept() only returns once the listening socket is shut down
+		if (listening_sock_ >= 0){ 
+			stop_listening();
+		}
 		accepting_ = false;
 
 		//clean up threads
-		if (unchoke_thread_.joinable()){
-			unchoke_thread_.join();
+		if (timers_){
+			delete timers_; //returns right away, pending timers are dropped
+			timers_ = nullptr;
 		}
-
-		for (auto& t : peer_threads_){
-			if (t.joinable()){
-				t.join();
-			}
+		if (connect_pool_){
+			delete connect_pool_; //a reconnect already in connect() finishes, queued ones see running_ and return
+			connect_pool_ = nullptr;
 		}
 
 		if (accept_thread_.joinable()){
 			accept_thread_.join();
 		}
+
+		if (reactor_){
+			reactor_->stop(); //no more pieces reach the verify pool
+		}
+		if (verify_pool_){
+			delete verify_pool_; //pending checks still queue writes and post to the (stopped) reactor
+			verify_pool_ = nullptr;
+		}
+		if (disk_pool_){
+			delete disk_pool_; //finishes the queued writes
+			disk_pool_ = nullptr;
+		}
+
+		if (reactor_){
+			delete reactor_; //joins the event loop threads
+			reactor_ = nullptr;
+		}
+
+		log_memory_stats(true);
+		if (cache_){
+			delete cache_; //pieces still queued for sending hold their own reference
+			cache_ = nullptr;
+		}
+		if (store_){
+			delete store_; //syncs anything the flush policy left pending
+			store_ = nullptr;
+		}
+		if (io_){
+			delete io_;
+			io_ = nullptr;
+		}
+		if (assembler_){
+			delete assembler_;
+			assembler_ = nullptr;
+		}
+		if (super_seeder_){
+			delete super_seeder_;
+			super_seeder_ = nullptr;
+		}
+		if (picker_){
+			delete picker_;
+			picker_ = nullptr;
+		}
+		if (meta_){
+			delete meta_;
+			meta_ = nullptr;
+		}
 		
 		// clean up sockets and neighbors
-		if (listening_sock_ >= 0){ 
-			stop_listening();
+		if (neighbors_){
+			delete neighbors_;
+			neighbors_ = nullptr;
 		}
-
-		for (auto* n :neighbors_){
-			delete n;
+		if (buffers_){
+			delete buffers_; //only drops the pool's own references
+			buffers_ = nullptr;
 		}
 
 		if (logger_){
@@ -214,8 +448,15 @@ public:
 
 	int listen_on();
 	int connect_to(std::string ip, uint16_t peer_port);
-	bool send_message(uint8_t type, const void* payload, uint32_t payload_len, int sock);
+	bool send_message(uint8_t type, const void* payload, uint32_t payload_len, Neighbor* n);
+	bool send_frames(Neighbor* n, FrameBatch& batch);
+	void broadcast_message(uint8_t type, const void* payload, uint32_t payload_len, int skip_sock = -1);
 	bool read_message(int sock);
+	bool on_writable(int sock);
+	bool serve_request(Neighbor* n, int piece_index, uint32_t begin, uint32_t length);
+	void fill_cache(int piece_index);
+	void read_ahead(Neighbor* n, int piece_index);
+	void log_memory_stats(bool to_log);
 	int start_communication();
 	bool on_new_connection(int sock, std::string ip, uint16_t port, uint32_t peer_id, bool has_file);
 	
@@ -224,33 +465,63 @@ public:
 	bool read_unchoke(int sock);
 	bool read_interested(int sock);
 	bool read_uninterested(int sock);
-	bool read_have(int sock, std::vector<char> buf);
-	bool read_request(int sock, std::vector<char> buf);
-	bool read_piece(int sock, std::vector<char> buf);
-	bool read_bitfield(int sock, std::vector<char> buf);
+	bool read_have(int sock, std::span<const char> buf);
+	bool read_request(int sock, std::span<const char> buf);
+	bool read_piece(int sock, std::span<const char> buf);
+	bool read_bitfield(int sock, std::span<const char> buf);
+	bool read_cancel(int sock, std::span<const char> buf);
 	bool send_handshake(int sock, uint32_t peer_id);
 	bool connect_and_handshake(std::string ip, uint16_t port, int peer_id, bool has_file);
 	void accept_loop();
 
 	//overloading read handshake (one for when peer id is known before)
 	bool read_handshake(int sock, std::string ip, uint16_t port, uint32_t expected_peer_id, bool has_file);
-	bool read_handshake(int sock, std::string ip, uint16_t port);
+	bool read_handshake(int sock, std::string ip, uint16_t port, uint32_t& peer_id);
 	int start_listening();
 	void stop_listening();
 	void addNeighbor(int sock, std::string ip, uint16_t port, uint32_t peer_id, bool has_file);
-	bool set_hasFile_from_bf(int sock, std::vector<char> buf);
+	bool set_hasFile_from_bf(int sock, std::span<const char> buf);
 
 	//helpers for file pieces
 	bool read_piece_from_file(int piece_index, std::vector<char>& piece_data);
-	bool write_piece_to_file(int piece_index, std::vector<char>& piece_data);
+	bool write_piece_to_file(int piece_index, std::span<const char> piece_data);
 	bool has_piece_on_disk(int piece_index) const;
+	size_t piece_length(int piece_index) const;
 	void set_bitfield_bit(int piece_index, bool value);
 	bool has_piece(int piece_index) const;
 	bool has_complete_file() const;
 
-	void start_peer_message_loop(int sock);
-
-	void request_next_piece(int sock);
+	bool watch_connection(int sock);
+
+	void request_next_piece(int sock, FrameBatch& out);
+	bool reserve_next_block(Neighbor* n, int& piece_index, uint32_t& begin, uint32_t& length);
+	void release_requests(Neighbor* n);
+	void expire_requests(int sock);
+	void expire_all();
+	void accept_piece(int piece_index, std::span<const char> piece_data, BufferPool::Buffer owned,
+		std::vector<uint32_t> contributors);
+	void queue_write(int piece_index, BufferPool::Buffer data, uint32_t from_peer);
+	void settle_piece(int piece_index, bool stored);
+	bool disk_backlogged() const;
+	void pause_requests();
+	void resume_requests();
+	void refill_all();
+	bool store_piece(int piece_index, std::span<const char> piece_data, uint32_t from_peer, int skip_sock);
+	void on_corrupt_piece(int piece_index, const std::vector<uint32_t>& contributors);
+	void refill_requests(int sock);
+	bool is_pending(int piece_index) const;
+	bool wants_piece(Neighbor* n, int piece_index) const;
+	int next_wanted(Neighbor* n, int from) const;
+	int pick_piece(Neighbor* n);
+	bool in_endgame();
+	int pick_endgame(Neighbor* n);
+	void cancel_elsewhere(int piece_index, uint32_t begin, int except_sock);
+	void cancel_request(int sock, int piece_index, uint32_t begin);
+	void add_cancel(Neighbor* n, FrameBatch& out, int piece_index, uint32_t begin, uint32_t length);
+	std::vector<char> piece_head(Neighbor* n, int piece_index, uint32_t begin, uint32_t length) const;
+	bool ensure_metainfo();
+	void prepare_metainfo();
+	bool verify_on_disk(int piece_index);
 
 
 
@@ -258,7 +529,7 @@ public:
 
 	//getters
 	uint32_t peer_id(){ return my_peer_id_;}
-	std::vector<uint8_t> bitfield(){return bitfield_;}
+	std::vector<uint8_t> bitfield(){return bitfield_.to_bytes();}
 	uint16_t port(){return port_;}
 };
 
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include "BufferPool.hpp"
+
+//pieces that are being downloaded block by block (EXT_BLOCKS), possibly from several neighbors at once
+//a block is reserved while a request for it is out so two neighbors are never asked for the same block
+//thread safe, blocks of one piece can arrive on different reactor threads
+class PieceAssembler {
+public:
+	enum class BlockResult {
+		Rejected,  //not a block we are waiting for (unknown piece, bad offset, duplicate)
+		Stored,    //kept, the piece still has missing blocks
+		Completed, //that was the last block, the whole piece was handed back
+	};
+
+	//piece buffers come from pool (nullptr => plain allocations)
+	PieceAssembler(int total_pieces, size_t piece_size, size_t file_size, size_t block_size, BufferPool* pool = nullptr);
+
+	size_t block_size() const { return block_size_; }
+	size_t piece_length(int piece_index) const;
+
+	//reserves a missing block of a piece already in progress, taking only pieces accept() agrees to
+	bool reserve_block(const std::function<bool(int)>& accept, int& piece_index, uint32_t& begin, uint32_t& length);
+
+	//endgame: a block that is requested from someone else but hasn't arrived, in a piece accept() agrees
+	//to, for asking a second neighbor as well. accept_block() rules out blocks already asked of that one
+	bool duplicate_block(const std::function<bool(int)>& accept, const std::function<bool(int, uint32_t)>& accept_block,
+		int& piece_index, uint32_t& begin, uint32_t& length);
+
+	//starts assembling a new piece and reserves its first block
+	bool start_piece(int piece_index, uint32_t& begin, uint32_t& length);
+
+	bool in_progress(int piece_index) const;
+
+	//gives a reserved block back (choke, disconnect) so it can be requested elsewhere
+	void release(int piece_index, uint32_t begin);
+
+	//from is the sending peer. on Completed, piece receives the assembled data, contributors every
+	//peer that sent part of it, and the piece is forgotten
+	BlockResult add_block(int piece_index, uint32_t begin, std::span<const char> data, uint32_t from,
+		BufferPool::Buffer& piece, std::vector<uint32_t>& contributors);
+
+private:
+	enum : uint8_t { MISSING = 0, REQUESTED = 1, RECEIVED = 2 };
+
+	struct Partial {
+		BufferPool::Buffer data;
+		std::vector<uint8_t> blocks; //MISSING/REQUESTED/RECEIVED per block
+		size_t received = 0;
+		std::vector<uint32_t> contributors; //peers that sent blocks (no duplicates)
+	};
+
+	bool reserve_in(Partial& p, int piece_index, uint32_t& begin, uint32_t& length);
+
+	int total_pieces_;
+	size_t piece_size_;
+	size_t file_size_;
+	size_t block_size_;
+	BufferPool* pool_;
+
+	std::unordered_map<int, Partial> partials_;
+	mutable std::mutex mu_;
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//recently served or written pieces kept in memory, so a piece many neighbors ask for at once is read
+//from disk a single time and a cold page cache never stalls a reactor thread inside sendfile
+//
+//split into shards (by piece index) with an LRU list each, so reactor threads serving different
+//pieces rarely share a lock. the budget is divided evenly between the shards. pieces are handed out
+//as shared pointers, an evicted piece stays alive until the last queued send of it is done
+class PieceCache {
+public:
+	using Piece = std::shared_ptr<const std::vector<char>>;
+
+	static const size_t SHARDS = 8;
+	static const size_t MAX_FILLS = 16; //pieces being read from disk at the same time
+
+	struct Stats {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		uint64_t fills = 0; //pieces read in, on a miss or ahead of time
+		size_t bytes = 0;
+		size_t pieces = 0;
+	};
+
+	explicit PieceCache(size_t budget);
+
+	PieceCache(const PieceCache&) = delete;
+	PieceCache& operator=(const PieceCache&) = delete;
+
+	size_t budget() const { return budget_; }
+
+	//nullptr on a miss, a hit moves the piece to the front of its LRU list
+	Piece get(int piece_index);
+	bool contains(int piece_index) const;
+	//adds (or replaces) a piece, evicting the least recently used ones of its shard to stay in budget
+	void insert(int piece_index, Piece piece);
+
+	//claims the disk read of a piece that is neither cached nor already being read, false otherwise
+	bool begin_fill(int piece_index);
+	//ends a claimed read, data is nullptr when the read failed
+	void end_fill(int piece_index, Piece piece);
+
+	Stats stats() const;
+
+private:
+	struct Shard {
+		std::list<int> lru; //most recently used first
+		std::unordered_map<int, std::pair<Piece, std::list<int>::iterator>> pieces;
+		size_t bytes = 0;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		mutable std::mutex mu;
+	};
+
+	Shard& shard_of(int piece_index) { return shards_[static_cast<size_t>(piece_index) % SHARDS]; }
+	const Shard& shard_of(int piece_index) const { return shards_[static_cast<size_t>(piece_index) % SHARDS]; }
+
+	size_t budget_;
+	size_t shard_budget_;
+	Shard shards_[SHARDS];
+
+	std::unordered_set<int> filling_;
+	uint64_t fills_ = 0;
+	mutable std::mutex fill_mu_;
+};
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "Bitfield.hpp"
+
+//which piece to ask a neighbor for next
+enum class PickPolicy {
+	RarestFirst, //fewest neighbors have it, ties broken at random
+	Sequential,  //lowest index first
+};
+
+//counts how many connected neighbors have each piece, kept up to date from BITFIELD, HAVE and
+//disconnects, and picks the next piece to request
+//
+//pieces we still lack sit in one bucket per availability count, each piece knows its position in its
+//bucket, so a count changes in O(1) (swap with the last entry and move). picking walks the buckets from
+//the rarest up and starts at a random position inside each one, the first piece the neighbor has and
+//accept() agrees to wins. that is O(missing) for a neighbor that has none of the rare pieces (one bit
+//test per entry), usually it stops in the first bucket or two
+//
+//a piece requested whole is reserved for the neighbor asked, and not picked again until that neighbor
+//delivers it or the reservation is released (CHOKE, disconnect, timeout). so outside endgame a piece
+//is only ever in flight from one neighbor
+//
+//thread safe. accept() runs under the picker's lock, so it may take other locks (pending_mu_) but
+//nobody may call into the picker while holding those
+class PiecePicker {
+public:
+	//have: the pieces we start with, they are never picked
+	explicit PiecePicker(const Bitfield& have, PickPolicy policy = PickPolicy::RarestFirst);
+
+	PiecePicker(const PiecePicker&) = delete;
+	PiecePicker& operator=(const PiecePicker&) = delete;
+
+	PickPolicy policy() const { return policy_; }
+
+	//a neighbor's pieces appear (BITFIELD) or go away (disconnect, or a BITFIELD replacing them)
+	void add_peer(const Bitfield& pieces);
+	void remove_peer(const Bitfield& pieces);
+	//a neighbor announced a piece it didn't have before
+	void on_have(int piece_index);
+
+	//we have the piece now, it is never picked again (its count is still kept)
+	void on_complete(int piece_index);
+
+	//next unreserved piece to ask for among those in theirs that accept() agrees to, -1 if none
+	int pick(const Bitfield& theirs, const std::function<bool(int)>& accept);
+	//the same, and reserves the piece for peer before anyone else can pick it
+	int pick_and_reserve(const Bitfield& theirs, uint32_t peer, const std::function<bool(int)>& accept);
+
+	//drops the reservation if peer holds it
+	void release(int piece_index, uint32_t peer);
+	//drops every reservation peer holds
+	void release_peer(uint32_t peer);
+	bool reserved(int piece_index) const;
+
+	//how many connected neighbors have the piece
+	uint32_t availability(int piece_index) const;
+	//up to k pieces in ours that theirs lacks, fewest neighbors first, skip left out: what a neighbor
+	//picking rarest-first is likely to ask us for next. O(pieces ours has and theirs lacks)
+	std::vector<int> rarest_missing(const Bitfield& ours, const Bitfield& theirs, size_t k, int skip) const;
+
+private:
+	void add(int piece_index, int delta);
+	void unlink(int piece_index);
+	void link(int piece_index);
+	int pick_unreserved(const Bitfield& theirs, const std::function<bool(int)>& accept);
+	int pick_rarest(const Bitfield& theirs, const std::function<bool(int)>& accept);
+	int pick_sequential(const Bitfield& theirs, const std::function<bool(int)>& accept);
+
+	int total_pieces_;
+	PickPolicy policy_;
+
+	std::vector<uint32_t> count_;          //neighbors that have each piece
+	std::vector<int> pos_;                 //position in buckets_[count_], -1 once the piece is complete
+	std::vector<std::vector<int>> buckets_; //pieces we lack, by availability
+	std::unordered_map<int, uint32_t> reserved_; //piece -> peer it was requested whole from
+	Bitfield done_;                        //pieces we have
+	Bitfield none_;                        //all clear, for walking the set bits of a bitfield
+
+	std::minstd_rand rng_;
+	mutable std::mutex mu_;
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+#include "IoEngine.hpp"
+#include "ResumeFile.hpp"
+
+//when written pieces are forced to stable storage
+enum class FlushPolicy {
+	Piece,    //fdatasync after every piece
+	Batch,    //fdatasync every flush_batch pieces
+	Complete, //fdatasync once the file is complete (and on shutdown)
+};
+
+enum class StoreMode {
+	Pread, //positional reads and writes (or io_uring)
+	Mmap,  //the whole file mapped: read-only for seeds, read-write for leechers if allowed
+};
+
+//access pattern hint passed to madvise for the mapping
+enum class MapAdvice {
+	Normal,
+	Sequential,
+	Random,
+};
+
+//optional settings for PieceStore
+struct StoreOptions {
+	StoreMode mode = StoreMode::Pread;
+	bool map_writable = false; //leechers map the file too (it is grown to FileSize up front)
+	MapAdvice advice = MapAdvice::Normal;
+	FlushPolicy flush_policy = FlushPolicy::Batch;
+	unsigned int flush_batch = 32; //pieces per fdatasync with FlushPolicy::Batch
+};
+
+//the shared data file, opened once and accessed with positional I/O or through a mapping
+//reads and writes of different pieces never share a lock (io_uring serializes inside IoEngine)
+class PieceStore {
+public:
+	PieceStore(const std::string& path, size_t file_size, size_t piece_size, int total_pieces,
+		IoEngine* io, const StoreOptions& options);
+	~PieceStore();
+
+	PieceStore(const PieceStore&) = delete;
+	PieceStore& operator=(const PieceStore&) = delete;
+
+	//opens (or creates) the file and reserves FileSize bytes for it, false if it can't be opened
+	bool open();
+
+	int fd() const { return fd_; }
+	size_t piece_length(int piece_index) const;
+
+	//start of the piece inside the mapping, nullptr when the file isn't mapped
+	const char* mapped(int piece_index) const;
+
+	bool read_piece(int piece_index, std::vector<char>& piece_data);
+	bool write_piece(int piece_index, std::span<const char> piece_data);
+
+	//whether the file already covered this piece when it was opened (leftovers from an earlier run)
+	bool on_disk(int piece_index) const;
+
+	//piece state saved by an earlier run, false if there is none. clean when that run shut down cleanly
+	//and the data file is unchanged since, the bitfield is then taken as it is. otherwise pieces the
+	//data file no longer covers are left out, the contents aren't checked
+	bool load_resume(std::vector<uint8_t>& bitfield, bool& clean);
+	//starts a fresh resume file from this state, pieces are added to it as they are synced
+	bool reset_resume(const std::vector<uint8_t>& bitfield);
+
+	//forces everything written so far to stable storage and records those pieces in the resume file
+	bool sync();
+	//called once every piece is in, syncs whatever the policy left pending
+	void on_complete();
+
+private:
+	void map_file();
+
+	std::string path_;
+	size_t file_size_;
+	size_t piece_size_;
+	int total_pieces_;
+	IoEngine* io_;
+	StoreOptions options_;
+
+	int fd_ = -1;
+	char* map_ = nullptr;
+	bool map_writable_ = false;
+	size_t initial_size_ = 0; //size before this run wrote anything (preallocation keeps the size)
+
+	ResumeFile* resume_ = nullptr;
+	std::vector<int> unsynced_; //pieces written since the last sync
+	std::mutex unsynced_mu_;
+	std::mutex sync_mu_; //one sync at a time, and none while the resume file is replaced
+};
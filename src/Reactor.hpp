@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//event loop for peer connections
+//every socket is owned by exactly one shard (one epoll fd + one thread) so handlers for a
+//given socket never run on two threads at once. sockets are spread over the least loaded shard
+class Reactor {
+public:
+	//return false to have the reactor drop the socket (on_closed is called afterwards)
+	using ReadHandler = std::function<bool(int sock)>;
+	using WriteHandler = std::function<bool(int sock)>;
+	using CloseHandler = std::function<void(int sock)>;
+
+	//num_threads == 0 means one shard per core
+	Reactor(unsigned int num_threads, ReadHandler on_readable, WriteHandler on_writable, CloseHandler on_closed);
+	~Reactor();
+
+	Reactor(const Reactor&) = delete;
+	Reactor& operator=(const Reactor&) = delete;
+
+	bool start();
+	void stop();
+
+	//switches the socket to non-blocking mode and hands it to a shard
+	bool add(int sock);
+	//stops watching the socket, does not close it
+	void remove(int sock);
+	//turns EPOLLOUT on or off, safe from any thread (no-op for sockets the reactor doesn't own)
+	void set_writable(int sock, bool on);
+	//runs task on the thread that owns sock, so it never races that socket's handlers
+	//false (task dropped) if the reactor doesn't own the socket
+	bool post(int sock, std::function<void()> task);
+
+	unsigned int num_threads() const { return static_cast<unsigned int>(shards_.size()); }
+
+private:
+	struct Shard {
+		int epoll_fd = -1;
+		int wake_fd = -1; //eventfd used to interrupt epoll_wait (shutdown, posted tasks)
+		std::thread thread;
+		std::atomic<size_t> load{0};
+		std::deque<std::function<void()>> tasks;
+		std::mutex tasks_mu;
+	};
+
+	struct Watch {
+		Shard* shard;
+		bool writable; //EPOLLOUT is armed
+	};
+
+	void run(Shard* shard);
+	void run_tasks(Shard* shard);
+	void drop(int sock);
+
+	std::vector<Shard*> shards_;
+	std::unordered_map<int, Watch> owner_;
+	std::mutex owner_mu_;
+
+	ReadHandler on_readable_;
+	WriteHandler on_writable_;
+	CloseHandler on_closed_;
+	std::atomic<bool> running_;
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//piece-completion state kept next to the data file so a restart doesn't have to probe every piece
+//
+//layout (host byte order, the file never leaves the machine):
+//  magic[8] version:u32 total_pieces:u32 generation:u64 file_size:u64 piece_size:u64
+//  clean:u32 reserved:u32 data_size:u64 mtime_sec:i64 mtime_nsec:i64
+//  then the bitfield (MSB first, like the BITFIELD message)
+//
+//a bit is only set after the piece's data has been synced, and the resume file is synced before
+//mark() returns, so after a crash every bit set still stands for durable data. pieces written since
+//the last mark() are simply missing and get downloaded again
+//
+//clean is cleared while a run has the file open and set by close() once everything is synced,
+//together with the data file's size and mtime at that point (the data file is fsynced first, so the
+//mtime is on disk too). a clean state whose stamp still matches can be trusted as it is, anything
+//else (a crash, the data file touched in between) tells the caller to check the pieces it gets back
+class ResumeFile {
+public:
+	ResumeFile(const std::string& path, size_t file_size, size_t piece_size, int total_pieces);
+	~ResumeFile();
+
+	ResumeFile(const ResumeFile&) = delete;
+	ResumeFile& operator=(const ResumeFile&) = delete;
+
+	//fills bitfield if the file belongs to this data file, false if missing or from another one. clean
+	//tells if the last run closed it cleanly and the data file (size, mtime) hasn't changed since
+	bool load(size_t data_size, const timespec& data_mtime, std::vector<uint8_t>& bitfield, bool& clean);
+
+	//replaces the file with the given state (written aside, synced and renamed) and keeps it open for mark()
+	bool reset(const std::vector<uint8_t>& bitfield);
+
+	//records pieces whose data is now durable, returns once the record itself is
+	bool mark(const std::vector<int>& pieces);
+	//records a clean shutdown: every piece written is synced and recorded, the data file (already
+	//fsynced) has this size and mtime. the file is closed, mark() does nothing afterwards
+	bool close(size_t data_size, const timespec& data_mtime);
+
+	uint64_t generation() const { return generation_; }
+
+private:
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t total_pieces;
+		uint64_t generation;
+		uint64_t file_size;
+		uint64_t piece_size;
+		uint32_t clean;
+		uint32_t reserved;
+		uint64_t data_size;
+		int64_t mtime_sec;
+		int64_t mtime_nsec;
+	};
+
+	Header make_header() const;
+	void sync_dir() const;
+
+	std::string path_;
+	size_t file_size_;
+	size_t piece_size_;
+	int total_pieces_;
+
+	int fd_ = -1;
+	uint64_t generation_ = 0;
+	std::vector<uint8_t> bits_; //what the file currently says
+	std::mutex mu_;
+};
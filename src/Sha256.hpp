@@ -0,0 +1,19 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+//SHA-256 for piece digests. uses the x86 SHA extensions when the CPU has them (checked once at
+//runtime), the portable version otherwise. pieces are hashed in parallel on the verify pool
+namespace sha256 {
+
+using Digest = std::array<uint8_t, 32>;
+
+Digest hash(const void* data, size_t len);
+//always the portable code, to check the accelerated one against
+Digest hash_portable(const void* data, size_t len);
+
+//true when the SHA-NI code path is in use
+bool accelerated();
+
+}
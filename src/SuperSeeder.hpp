@@ -0,0 +1,70 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "Bitfield.hpp"
+#include "PiecePicker.hpp"
+
+//super-seeding: a seed that hides its bitfield and reveals one piece at a time to each neighbor with
+//HAVE, so it uploads pieces the swarm doesn't have yet instead of copies the leechers could have
+//traded among themselves
+//
+//a neighbor gets its next piece once the last one has been seen propagating: another neighbor
+//announced it with HAVE, so the first one passed it on. the piece revealed is one nobody has been
+//shown yet if possible, then the one the fewest neighbors have, so the copies spread over the whole
+//file. once every piece is held by some neighbor the swarm has a distributed copy and the seed can
+//show its bitfield like any other
+//
+//thread safe, the picker's lock is taken inside this one
+class SuperSeeder {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	SuperSeeder(int total_pieces, const PiecePicker& picker);
+
+	SuperSeeder(const SuperSeeder&) = delete;
+	SuperSeeder& operator=(const SuperSeeder&) = delete;
+
+	//the pieces a neighbor has from its BITFIELD
+	void add_peer(const Bitfield& pieces);
+	//forgets what was revealed to peer
+	void remove_peer(uint32_t peer);
+
+	//from announced a piece. returns the neighbors that may be shown their next piece: those it was
+	//revealed to (from passed it on or got it elsewhere), and from itself if it has its revealed piece
+	//now and someone else already announced it
+	std::vector<uint32_t> on_have(uint32_t from, int piece_index);
+
+	//reveals the next piece to peer among those it lacks, -1 if it has every piece
+	int reveal(uint32_t peer, const Bitfield& theirs);
+	//the piece last revealed to peer, -1 if none yet
+	int revealed(uint32_t peer) const;
+	//neighbors whose revealed piece hasn't changed for timeout
+	std::vector<uint32_t> stalled(Clock::time_point now, Clock::duration timeout) const;
+
+	//every piece is held by some neighbor
+	bool complete() const;
+
+private:
+	struct Offer {
+		int piece;
+		Clock::time_point at;
+		bool propagated; //someone besides the neighbor announced the piece
+	};
+
+	bool mark_seen(int piece_index);
+
+	int total_pieces_;
+	const PiecePicker& picker_;
+	std::vector<uint32_t> reveals_; //neighbors each piece was revealed to
+	Bitfield seen_;                 //pieces some neighbor announced
+	size_t seen_count_ = 0;
+	std::unordered_map<uint32_t, Offer> offers_; //peer -> piece revealed to it
+
+	std::minstd_rand rng_;
+	mutable std::mutex mu_;
+};
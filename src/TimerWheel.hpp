@@ -0,0 +1,81 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//every timer of a peer on one thread: choking rounds, optimistic rotation, request deadlines, rate
+//samples and reconnects
+//
+//hierarchical wheel with LEVELS levels of SLOTS slots. level 0 holds timers due within SLOTS ticks, one
+//slot per tick, level 1 those due within SLOTS^2 ticks, one slot per SLOTS ticks, and so on. every
+//SLOTS ticks the next slot of level 1 is moved down (and of level 2 every SLOTS^2 ticks...), so adding
+//and cancelling a timer are O(1) and a tick only touches the timers that are due. a timer runs within
+//one tick after its deadline (as long as the tasks before it are short)
+//
+//tasks run on the wheel's thread without its lock held, they may add and cancel timers but must not
+//block (hand blocking work to a WorkerPool) and must not call stop()
+class TimerWheel {
+public:
+	using Clock = std::chrono::steady_clock;
+	using Task = std::function<void()>;
+	using TimerId = uint64_t;
+
+	static const int SLOT_BITS = 6;
+	static const int SLOTS = 1 << SLOT_BITS;
+	static const int LEVELS = 4; //2^24 ticks, a few days at 10 ms, later deadlines are moved down in steps
+
+	explicit TimerWheel(Clock::duration tick = std::chrono::milliseconds(10));
+	//stop()
+	~TimerWheel();
+
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	//runs task once, delay from now
+	TimerId after(Clock::duration delay, Task task);
+	//runs task every period, the first time one period from now. runs missed while the thread was
+	//held up are skipped, not made up for
+	TimerId every(Clock::duration period, Task task);
+	//false if the timer already ran (one-shot) or was cancelled. a task that is running right now
+	//finishes, a periodic one is not run again
+	bool cancel(TimerId id);
+
+	//drops every pending timer and joins the thread without waiting for the next tick
+	void stop();
+
+	Clock::duration tick() const { return tick_; }
+	size_t pending() const;
+
+private:
+	struct Timer {
+		uint64_t due;    //tick it runs at
+		uint64_t period; //ticks, 0 for one-shot
+		Task task;
+	};
+
+	void run();
+	TimerId add(Clock::duration delay, uint64_t period, Task task);
+	uint64_t elapsed_ticks(Clock::time_point t) const;
+	uint64_t to_ticks(Clock::duration d) const;
+	void place(TimerId id, uint64_t due);
+	void cascade(int level);
+	void expire(uint64_t target, std::vector<Task>& due);
+
+	Clock::duration tick_;
+	Clock::time_point start_;
+	uint64_t now_ = 0; //next tick to process
+	TimerId next_id_ = 1;
+	std::unordered_map<TimerId, Timer> timers_; //cancelled timers are only dropped from here, their slot skips them
+	std::vector<TimerId> wheel_[LEVELS][SLOTS];
+
+	bool stopping_ = false;
+	mutable std::mutex mu_;
+	std::condition_variable cv_;
+	std::thread thread_;
+};
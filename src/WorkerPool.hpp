@@ -0,0 +1,39 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//fixed set of threads running submitted tasks in FIFO order, for work that must not run on the
+//reactor threads (hashing and writing pieces). the destructor finishes queued tasks before joining
+class WorkerPool {
+public:
+	using Task = std::function<void()>;
+
+	//num_threads == 0 means one per core
+	explicit WorkerPool(unsigned int num_threads);
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	void submit(Task task);
+	//blocks until every task submitted so far has run
+	void wait_idle();
+
+	unsigned int num_threads() const { return static_cast<unsigned int>(threads_.size()); }
+
+private:
+	void run();
+
+	std::vector<std::thread> threads_;
+	std::deque<Task> tasks_;
+	size_t busy_ = 0;
+	bool stopping_ = false;
+	std::mutex mu_;
+	std::condition_variable work_cv_;
+	std::condition_variable idle_cv_;
+};
@@ -0,0 +1,219 @@
+#include "Bitfield.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BITFIELD_X86 1
+#endif
+
+//wire bytes <-> word, piece 0 in the most significant bit
+static uint64_t load_word(const uint8_t* p, size_t n){
+	uint8_t b[8] = {0};
+	std::memcpy(b, p, n);
+	uint64_t w = 0;
+	std::memcpy(&w, b, 8);
+	return __builtin_bswap64(w);
+}
+
+static size_t first_and_not_scalar(const uint64_t* a, const uint64_t* b, size_t begin, size_t end){
+	for (size_t w = begin; w < end; ++w){
+		if ((a[w] & ~b[w]) != 0){
+			return w;
+		}
+	}
+	return end;
+}
+
+static size_t count_and_not_scalar(const uint64_t* a, const uint64_t* b, size_t n){
+	size_t c = 0;
+	for (size_t w = 0; w < n; ++w){
+		c += static_cast<size_t>(std::popcount(a[w] & ~b[w]));
+	}
+	return c;
+}
+
+#ifdef BITFIELD_X86
+//skips 256 bits per step while a & ~b is all zero
+__attribute__((target("avx2")))
+static size_t first_and_not_avx2(const uint64_t* a, const uint64_t* b, size_t begin, size_t end){
+	size_t w = begin;
+	for (; w + 4 <= end; w += 4){
+		__m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + w));
+		__m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + w));
+		__m256i x = _mm256_andnot_si256(vb, va);
+		if (!_mm256_testz_si256(x, x)){
+			break;
+		}
+	}
+	return first_and_not_scalar(a, b, w, end);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_and_not_avx2(const uint64_t* a, const uint64_t* b, size_t n){
+	size_t c = 0;
+	size_t w = 0;
+	for (; w + 4 <= n; w += 4){
+		__m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + w));
+		__m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + w));
+		__m256i x = _mm256_andnot_si256(vb, va);
+		c += static_cast<size_t>(_mm_popcnt_u64(static_cast<uint64_t>(_mm256_extract_epi64(x, 0))));
+		c += static_cast<size_t>(_mm_popcnt_u64(static_cast<uint64_t>(_mm256_extract_epi64(x, 1))));
+		c += static_cast<size_t>(_mm_popcnt_u64(static_cast<uint64_t>(_mm256_extract_epi64(x, 2))));
+		c += static_cast<size_t>(_mm_popcnt_u64(static_cast<uint64_t>(_mm256_extract_epi64(x, 3))));
+	}
+	for (; w < n; ++w){
+		c += static_cast<size_t>(_mm_popcnt_u64(a[w] & ~b[w]));
+	}
+	return c;
+}
+
+static bool cpu_has_avx2(){
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+}
+#endif
+
+using FirstAndNot = size_t (*)(const uint64_t*, const uint64_t*, size_t, size_t);
+using CountAndNot = size_t (*)(const uint64_t*, const uint64_t*, size_t);
+
+#ifdef BITFIELD_X86
+static const bool use_avx2 = cpu_has_avx2();
+static const FirstAndNot first_and_not_kernel = use_avx2 ? first_and_not_avx2 : first_and_not_scalar;
+static const CountAndNot count_and_not_kernel = use_avx2 ? count_and_not_avx2 : count_and_not_scalar;
+#else
+static const bool use_avx2 = false;
+static const FirstAndNot first_and_not_kernel = first_and_not_scalar;
+static const CountAndNot count_and_not_kernel = count_and_not_scalar;
+#endif
+
+bool Bitfield::accelerated(){
+	return use_avx2;
+}
+
+Bitfield::Bitfield(size_t num_bits, bool value){
+	assign(num_bits, value);
+}
+
+Bitfield::Bitfield(const Bitfield& other)
+	: words_(other.words_), num_bits_(other.num_bits_), count_(other.count()){}
+
+Bitfield& Bitfield::operator=(const Bitfield& other){
+	if (this != &other){
+		words_ = other.words_;
+		num_bits_ = other.num_bits_;
+		count_ = other.count();
+	}
+	return *this;
+}
+
+void Bitfield::assign(size_t num_bits, bool value){
+	num_bits_ = num_bits;
+	words_.assign((num_bits + 63) / 64, value ? ~uint64_t(0) : 0);
+	if (value && (num_bits & 63) != 0){
+		words_.back() = ~uint64_t(0) << (64 - (num_bits & 63)); //spare bits stay zero
+	}
+	count_ = value ? num_bits : 0;
+}
+
+void Bitfield::assign_bytes(std::span<const uint8_t> bytes){
+	size_t n = std::min(bytes.size(), (num_bits_ + 7) / 8);
+	for (size_t w = 0; w < words_.size(); ++w){
+		size_t at = w * 8;
+		words_[w] = at < n ? load_word(bytes.data() + at, std::min<size_t>(8, n - at)) : 0;
+	}
+	if ((num_bits_ & 63) != 0 && !words_.empty()){
+		words_.back() &= ~uint64_t(0) << (64 - (num_bits_ & 63));
+	}
+	recount();
+}
+
+void Bitfield::assign_bytes(std::span<const char> bytes){
+	assign_bytes(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size()));
+}
+
+std::vector<uint8_t> Bitfield::to_bytes() const {
+	std::vector<uint8_t> out((num_bits_ + 7) / 8);
+	for (size_t w = 0; w < words_.size(); ++w){
+		uint64_t be = __builtin_bswap64(__atomic_load_n(&words_[w], __ATOMIC_ACQUIRE));
+		size_t at = w * 8;
+		std::memcpy(out.data() + at, &be, std::min<size_t>(8, out.size() - at));
+	}
+	return out;
+}
+
+bool Bitfield::set(size_t i){
+	if (i >= num_bits_){
+		return false;
+	}
+	uint64_t m = mask(i);
+	uint64_t old = __atomic_fetch_or(&words_[i >> 6], m, __ATOMIC_ACQ_REL);
+	if ((old & m) != 0){
+		return false;
+	}
+	__atomic_add_fetch(&count_, 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+bool Bitfield::reset(size_t i){
+	if (i >= num_bits_){
+		return false;
+	}
+	uint64_t m = mask(i);
+	uint64_t old = __atomic_fetch_and(&words_[i >> 6], ~m, __ATOMIC_ACQ_REL);
+	if ((old & m) == 0){
+		return false;
+	}
+	__atomic_sub_fetch(&count_, 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+void Bitfield::recount(){
+	size_t c = 0;
+	for (uint64_t w : words_){
+		c += static_cast<size_t>(std::popcount(w));
+	}
+	count_ = c;
+}
+
+long Bitfield::first_and_not(const Bitfield& a, const Bitfield& b, size_t from){
+	return first_and_not(a, b, from, first_and_not_kernel);
+}
+
+long Bitfield::first_and_not_portable(const Bitfield& a, const Bitfield& b, size_t from){
+	return first_and_not(a, b, from, first_and_not_scalar);
+}
+
+long Bitfield::first_and_not(const Bitfield& a, const Bitfield& b, size_t from, FirstAndNot kernel){
+	size_t bits = std::min(a.num_bits_, b.num_bits_);
+	if (from >= bits){
+		return -1;
+	}
+	size_t words = (bits + 63) / 64;
+	size_t w = from >> 6;
+
+	//the first word may start part way in
+	uint64_t x = a.words_[w] & ~b.words_[w] & (~uint64_t(0) >> (from & 63));
+	if (x == 0){
+		w = kernel(a.words_.data(), b.words_.data(), w + 1, words);
+		if (w == words){
+			return -1;
+		}
+		x = a.words_[w] & ~b.words_[w];
+	}
+	size_t i = w * 64 + static_cast<size_t>(std::countl_zero(x));
+	return i < bits ? static_cast<long>(i) : -1;
+}
+
+size_t Bitfield::count_and_not(const Bitfield& a, const Bitfield& b){
+	return count_and_not(a, b, count_and_not_kernel);
+}
+
+size_t Bitfield::count_and_not_portable(const Bitfield& a, const Bitfield& b){
+	return count_and_not(a, b, count_and_not_scalar);
+}
+
+size_t Bitfield::count_and_not(const Bitfield& a, const Bitfield& b, CountAndNot kernel){
+	size_t words = std::min(a.words_.size(), b.words_.size());
+	return kernel(a.words_.data(), b.words_.data(), words);
+}
@@ -0,0 +1,39 @@
+#include "BufferPool.hpp"
+#include <atomic>
+
+BufferPool::BufferPool(size_t buffer_size, size_t max_buffers)
+	: buffer_size_(buffer_size), max_buffers_(max_buffers){
+	buffers_.reserve(max_buffers_);
+}
+
+BufferPool::Buffer BufferPool::acquire(size_t len){
+	std::lock_guard<std::mutex> lck(mu_);
+	if (len <= buffer_size_){
+		//only the pool can copy a buffer nobody else holds, so a count of 1 can't go back up under us
+		for (size_t i = 0; i < buffers_.size(); ++i){
+			size_t at = (next_ + i) % buffers_.size();
+			if (buffers_[at].use_count() == 1){
+				std::atomic_thread_fence(std::memory_order_acquire); //last holder's writes are done
+				next_ = at + 1;
+				stats_.reused++;
+				buffers_[at]->resize(len);
+				return buffers_[at];
+			}
+		}
+		if (buffers_.size() < max_buffers_){
+			Buffer b = std::make_shared<std::vector<char>>();
+			b->reserve(buffer_size_);
+			b->resize(len);
+			buffers_.push_back(b);
+			stats_.allocated++;
+			return b;
+		}
+	}
+	stats_.unpooled++;
+	return std::make_shared<std::vector<char>>(len);
+}
+
+BufferPool::Stats BufferPool::stats() const {
+	std::lock_guard<std::mutex> lck(mu_);
+	return stats_;
+}
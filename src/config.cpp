@@ -51,6 +51,78 @@ Config Config::load(const string& root) {
             else if (key == "PieceSize") {
                 in >> cfg.common.pieceSizeBytes;
             }
+            else if (key == "ReactorThreads") {
+                in >> cfg.common.reactorThreads;
+            }
+            else if (key == "IoBackend") {
+                in >> cfg.common.ioBackend;
+            }
+            else if (key == "RequestPipelining") {
+                in >> cfg.common.requestPipelining;
+            }
+            else if (key == "MaxOutstandingRequests") {
+                in >> cfg.common.maxOutstandingRequests;
+            }
+            else if (key == "BlockTransfers") {
+                in >> cfg.common.blockTransfers;
+            }
+            else if (key == "BlockSize") {
+                in >> cfg.common.blockSize;
+            }
+            else if (key == "SendQueueLimit") {
+                in >> cfg.common.sendQueueLimit;
+            }
+            else if (key == "FlushPolicy") {
+                in >> cfg.common.flushPolicy;
+            }
+            else if (key == "FlushBatch") {
+                in >> cfg.common.flushBatch;
+            }
+            else if (key == "StoreMode") {
+                in >> cfg.common.storeMode;
+            }
+            else if (key == "MmapWrite") {
+                in >> cfg.common.mmapWrite;
+            }
+            else if (key == "MmapAdvice") {
+                in >> cfg.common.mmapAdvice;
+            }
+            else if (key == "VerifyPieces") {
+                in >> cfg.common.verifyPieces;
+            }
+            else if (key == "VerifyThreads") {
+                in >> cfg.common.verifyThreads;
+            }
+            else if (key == "DiskThreads") {
+                in >> cfg.common.diskThreads;
+            }
+            else if (key == "DiskQueueDepth") {
+                in >> cfg.common.diskQueueDepth;
+            }
+            else if (key == "CacheSize") {
+                in >> cfg.common.cacheSize;
+            }
+            else if (key == "ReadAhead") {
+                in >> cfg.common.readAhead;
+            }
+            else if (key == "PiecePicker") {
+                in >> cfg.common.piecePicker;
+            }
+            else if (key == "Endgame") {
+                in >> cfg.common.endgame;
+            }
+            else if (key == "CancelMessages") {
+                in >> cfg.common.cancelMessages;
+            }
+            else if (key == "SeedChoking") {
+                in >> cfg.common.seedChoking;
+            }
+            else if (key == "SuperSeeding") {
+                in >> cfg.common.superSeeding;
+            }
+            else if (key == "SnubTimeout") {
+                in >> cfg.common.snubTimeoutSec;
+            }
             else {
                 string skip; getline(in, skip);
             } // ignore unknown stuff on that line
@@ -76,6 +148,57 @@ Config Config::load(const string& root) {
     if (cfg.common.pieceSizeBytes <= 0) {
         throw runtime_error("Common.cfg: PieceSize must be > 0");
     }
+    if (cfg.common.reactorThreads < 0) {
+        throw runtime_error("Common.cfg: ReactorThreads must be >= 0");
+    }
+    if (cfg.common.ioBackend != "posix" && cfg.common.ioBackend != "uring") {
+        throw runtime_error("Common.cfg: IoBackend must be posix or uring");
+    }
+    if (cfg.common.maxOutstandingRequests <= 0) {
+        throw runtime_error("Common.cfg: MaxOutstandingRequests must be > 0");
+    }
+    if (cfg.common.blockSize <= 0) {
+        throw runtime_error("Common.cfg: BlockSize must be > 0");
+    }
+    if (cfg.common.sendQueueLimit <= 0) {
+        throw runtime_error("Common.cfg: SendQueueLimit must be > 0");
+    }
+    if (cfg.common.flushPolicy != "piece" && cfg.common.flushPolicy != "batch" && cfg.common.flushPolicy != "complete") {
+        throw runtime_error("Common.cfg: FlushPolicy must be piece, batch or complete");
+    }
+    if (cfg.common.flushBatch <= 0) {
+        throw runtime_error("Common.cfg: FlushBatch must be > 0");
+    }
+    if (cfg.common.storeMode != "pread" && cfg.common.storeMode != "mmap") {
+        throw runtime_error("Common.cfg: StoreMode must be pread or mmap");
+    }
+    if (cfg.common.mmapAdvice != "normal" && cfg.common.mmapAdvice != "sequential" && cfg.common.mmapAdvice != "random") {
+        throw runtime_error("Common.cfg: MmapAdvice must be normal, sequential or random");
+    }
+    if (cfg.common.verifyThreads < 0) {
+        throw runtime_error("Common.cfg: VerifyThreads must be >= 0");
+    }
+    if (cfg.common.diskThreads <= 0) {
+        throw runtime_error("Common.cfg: DiskThreads must be > 0");
+    }
+    if (cfg.common.diskQueueDepth <= 0) {
+        throw runtime_error("Common.cfg: DiskQueueDepth must be > 0");
+    }
+    if (cfg.common.cacheSize < 0) {
+        throw runtime_error("Common.cfg: CacheSize must be >= 0");
+    }
+    if (cfg.common.readAhead < 0) {
+        throw runtime_error("Common.cfg: ReadAhead must be >= 0");
+    }
+    if (cfg.common.piecePicker != "rarest" && cfg.common.piecePicker != "sequential") {
+        throw runtime_error("Common.cfg: PiecePicker must be rarest or sequential");
+    }
+    if (cfg.common.seedChoking != "random" && cfg.common.seedChoking != "upload") {
+        throw runtime_error("Common.cfg: SeedChoking must be random or upload");
+    }
+    if (cfg.common.snubTimeoutSec <= 0) {
+        throw runtime_error("Common.cfg: SnubTimeout must be > 0");
+    }
 
     // Red PeerInfo.cfg
     {
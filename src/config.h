@@ -13,6 +13,30 @@ struct CommonCfg{
     string fileName = "tree.png";
     long long fileSizeBytes = 24301474;
     int pieceSizeBytes = 16384;
+    int reactorThreads = 0; // optional, 0 = one event loop thread per core
+    string ioBackend = "posix"; // optional, "posix" or "uring"
+    bool requestPipelining = false; // optional, offer request pipelining in the handshake
+    int maxOutstandingRequests = 16; // optional, cap for the pipelined request window
+    bool blockTransfers = false; // optional, offer sub-piece block requests in the handshake
+    int blockSize = 16384; // optional, size of one block request
+    long long sendQueueLimit = 2097152; // optional, bytes queued per neighbor before its requests wait
+    string flushPolicy = "batch"; // optional, "piece", "batch" or "complete"
+    int flushBatch = 32; // optional, pieces per sync with the batch policy
+    string storeMode = "pread"; // optional, "pread" or "mmap"
+    bool mmapWrite = false; // optional, leechers map the file read-write too
+    string mmapAdvice = "normal"; // optional, "normal", "sequential" or "random"
+    bool verifyPieces = true; // optional, check pieces against <FileName>.meta
+    int verifyThreads = 0; // optional, hashing threads, 0 => one per core
+    int diskThreads = 2; // optional, threads writing received pieces
+    int diskQueueDepth = 64; // optional, pieces waiting for the disk before requests pause
+    long long cacheSize = 16777216; // optional, bytes of served pieces kept in memory, 0 => off
+    int readAhead = 2; // optional, pieces read into the cache ahead of requests
+    string piecePicker = "rarest"; // optional, "rarest" or "sequential"
+    bool endgame = true; // optional, request the last pieces from every neighbor that has them
+    bool cancelMessages = false; // optional, offer CANCEL in the handshake
+    string seedChoking = "random"; // optional, "random" or "upload"
+    bool superSeeding = false; // optional, a peer with the file reveals pieces one at a time
+    int snubTimeoutSec = 60; // optional, seconds an unchoking neighbor may send nothing before it is demoted
 
     int pieceCount() const {
         if (pieceSizeBytes <= 0) return 0;
@@ -0,0 +1,167 @@
+#include "IoEngine.hpp"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+static const unsigned int RING_ENTRIES = 256;
+
+IoEngine::IoEngine(IoBackend requested)
+	: backend_(IoBackend::Posix){
+
+	if (requested != IoBackend::Uring){
+		return;
+	}
+
+	ring_ = new IoUring();
+	const uint8_t needed[] = {IORING_OP_READ, IORING_OP_WRITE};
+	if (!ring_->init(RING_ENTRIES) || !ring_->supports(needed, sizeof(needed))){
+		delete ring_;
+		ring_ = nullptr;
+		return; //kernel too old or io_uring disabled, stay on the posix path
+	}
+	backend_ = IoBackend::Uring;
+}
+
+IoEngine::~IoEngine(){
+	delete ring_; //unregisters the file
+}
+
+bool IoEngine::attach_file(int fd){
+	file_fd_ = fd;
+	if (ring_){
+		std::lock_guard<std::mutex> lck(mu_);
+		file_registered_ = ring_->register_files(&fd, 1);
+	}
+	return true;
+}
+
+bool IoEngine::read_file(void* buf, size_t len, uint64_t offset){
+	std::vector<FileOp> ops{FileOp{false, buf, len, offset}};
+	file_batch(ops);
+	return ops[0].ok;
+}
+
+bool IoEngine::write_file(const void* buf, size_t len, uint64_t offset){
+	std::vector<FileOp> ops{FileOp{true, const_cast<void*>(buf), len, offset}};
+	file_batch(ops);
+	return ops[0].ok;
+}
+
+//finishes a short read/write with plain syscalls
+static bool finish_file_op(int fd, FileOp& op, size_t done){
+	char* p = static_cast<char*>(op.buf);
+	while (done < op.len){
+		ssize_t r = op.write ? pwrite(fd, p + done, op.len - done, op.offset + done)
+		                     : pread(fd, p + done, op.len - done, op.offset + done);
+		if (r < 0 && errno == EINTR){
+			continue;
+		}
+		if (r <= 0){
+			return false;
+		}
+		done += static_cast<size_t>(r);
+	}
+	return true;
+}
+
+void IoEngine::file_batch(std::vector<FileOp>& ops){
+	if (file_fd_ < 0){
+		return;
+	}
+	if (uring()){
+		uring_file_batch(ops);
+		return;
+	}
+	for (auto& op : ops){
+		op.ok = finish_file_op(file_fd_, op, 0);
+	}
+}
+
+bool IoEngine::reap(std::vector<int32_t>& results, unsigned int count){
+	unsigned int popped = 0;
+	while (popped < count){
+		uint64_t user_data = 0;
+		int32_t res = 0;
+		if (ring_->pop_cqe(user_data, res)){
+			if (user_data < results.size()){
+				results[user_data] = res;
+			}
+			popped++;
+			continue;
+		}
+		if (ring_->submit_and_wait(1) < 0){
+			return false;
+		}
+	}
+	return true;
+}
+
+//the caller's ops join the queue. if nobody is submitting it takes the ring and submits the whole
+//queue, otherwise it waits: either the current batch already has its ops, or it becomes the next
+//submitter once that batch is done
+void IoEngine::uring_file_batch(std::vector<FileOp>& ops){
+	Waiter me{&ops, false};
+	std::unique_lock<std::mutex> lck(mu_);
+	waiting_.push_back(&me);
+	while (!me.done){
+		if (submitting_){
+			done_cv_.wait(lck);
+			continue;
+		}
+		submitting_ = true;
+		std::vector<Waiter*> batch;
+		batch.swap(waiting_);
+		lck.unlock();
+
+		std::vector<FileOp*> all;
+		for (Waiter* w : batch){
+			for (FileOp& op : *w->ops){
+				all.push_back(&op);
+			}
+		}
+		submit(all);
+
+		lck.lock();
+		for (Waiter* w : batch){
+			w->done = true;
+		}
+		submitting_ = false;
+		done_cv_.notify_all();
+	}
+}
+
+void IoEngine::submit(std::vector<FileOp*>& ops){
+	size_t start = 0;
+	while (start < ops.size()){
+		size_t count = 0;
+		while (start + count < ops.size()){
+			io_uring_sqe* sqe = ring_->get_sqe();
+			if (sqe == nullptr){
+				break; //queue full, submit what we have first
+			}
+			FileOp& op = *ops[start + count];
+			if (file_registered_){
+				sqe->fd = 0;
+				sqe->flags |= IOSQE_FIXED_FILE;
+			} else {
+				sqe->fd = file_fd_;
+			}
+			sqe->opcode = op.write ? IORING_OP_WRITE : IORING_OP_READ;
+			sqe->addr = reinterpret_cast<uint64_t>(op.buf);
+			sqe->off = op.offset;
+			sqe->len = static_cast<uint32_t>(op.len);
+			sqe->user_data = count;
+			count++;
+		}
+
+		std::vector<int32_t> results(count, -EIO);
+		ring_->submit_and_wait(static_cast<unsigned int>(count));
+		reap(results, static_cast<unsigned int>(count));
+
+		for (size_t i = 0; i < count; ++i){
+			FileOp& op = *ops[start + i];
+			op.ok = results[i] >= 0 && finish_file_op(file_fd_, op, static_cast<size_t>(results[i]));
+		}
+		start += count;
+	}
+}
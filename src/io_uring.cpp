@@ -0,0 +1,156 @@
+#include "IoUring.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int sys_setup(unsigned int entries, io_uring_params* p){
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int sys_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags){
+	return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int sys_register(int fd, unsigned int opcode, const void* arg, unsigned int nr_args){
+	return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+IoUring::~IoUring(){
+	if (sqes_){
+		munmap(sqes_, sqes_len_);
+	}
+	if (cq_ptr_ && cq_ptr_ != sq_ptr_){
+		munmap(cq_ptr_, cq_len_);
+	}
+	if (sq_ptr_){
+		munmap(sq_ptr_, sq_len_);
+	}
+	if (ring_fd_ >= 0){
+		close(ring_fd_);
+	}
+}
+
+bool IoUring::init(unsigned int entries){
+	io_uring_params p{};
+	int fd = sys_setup(entries, &p);
+	if (fd < 0){
+		return false;
+	}
+	ring_fd_ = fd;
+
+	sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single_mmap){
+		sq_len_ = cq_len_ = (sq_len_ > cq_len_) ? sq_len_ : cq_len_;
+	}
+
+	void* sq = mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED){
+		close(fd);
+		ring_fd_ = -1;
+		return false;
+	}
+	sq_ptr_ = sq;
+
+	if (single_mmap){
+		cq_ptr_ = sq_ptr_;
+	} else {
+		void* cq = mmap(nullptr, cq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED){
+			return false;
+		}
+		cq_ptr_ = cq;
+	}
+
+	sqes_len_ = p.sq_entries * sizeof(io_uring_sqe);
+	void* sqes = mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED){
+		return false;
+	}
+	sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+	char* sqb = static_cast<char*>(sq_ptr_);
+	sq_head_ = reinterpret_cast<unsigned int*>(sqb + p.sq_off.head);
+	sq_tail_ = reinterpret_cast<unsigned int*>(sqb + p.sq_off.tail);
+	sq_mask_ = reinterpret_cast<unsigned int*>(sqb + p.sq_off.ring_mask);
+	sq_array_ = reinterpret_cast<unsigned int*>(sqb + p.sq_off.array);
+	sq_entries_ = p.sq_entries;
+
+	char* cqb = static_cast<char*>(cq_ptr_);
+	cq_head_ = reinterpret_cast<unsigned int*>(cqb + p.cq_off.head);
+	cq_tail_ = reinterpret_cast<unsigned int*>(cqb + p.cq_off.tail);
+	cq_mask_ = reinterpret_cast<unsigned int*>(cqb + p.cq_off.ring_mask);
+	cqes_ = reinterpret_cast<io_uring_cqe*>(cqb + p.cq_off.cqes);
+	return true;
+}
+
+bool IoUring::supports(const uint8_t* ops, size_t count){
+	const unsigned int max_ops = 256;
+	size_t len = sizeof(io_uring_probe) + max_ops * sizeof(io_uring_probe_op);
+	char probe_buf[sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op)];
+	std::memset(probe_buf, 0, len);
+	io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probe_buf);
+
+	if (sys_register(ring_fd_, IORING_REGISTER_PROBE, probe, max_ops) < 0){
+		return false;
+	}
+	for (size_t i = 0; i < count; ++i){
+		if (ops[i] > probe->last_op){
+			return false;
+		}
+		if (!(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)){
+			return false;
+		}
+	}
+	return true;
+}
+
+bool IoUring::register_files(const int* fds, unsigned int count){
+	return sys_register(ring_fd_, IORING_REGISTER_FILES, fds, count) == 0;
+}
+
+io_uring_sqe* IoUring::get_sqe(){
+	unsigned int head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+	unsigned int tail = *sq_tail_ + pending_;
+	if (tail - head >= sq_entries_){
+		return nullptr;
+	}
+	unsigned int idx = tail & *sq_mask_;
+	io_uring_sqe* sqe = &sqes_[idx];
+	std::memset(sqe, 0, sizeof(*sqe));
+	sq_array_[idx] = idx;
+	pending_++;
+	return sqe;
+}
+
+int IoUring::submit_and_wait(unsigned int wait_nr){
+	unsigned int to_submit = pending_;
+	__atomic_store_n(sq_tail_, *sq_tail_ + pending_, __ATOMIC_RELEASE);
+	pending_ = 0;
+
+	while (true){
+		int r = sys_enter(ring_fd_, to_submit, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+		if (r < 0 && errno == EINTR){
+			//only resubmit what the kernel has not consumed yet
+			to_submit = *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+			continue;
+		}
+		return r;
+	}
+}
+
+bool IoUring::pop_cqe(uint64_t& user_data, int32_t& res){
+	unsigned int head = *cq_head_;
+	unsigned int tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+	if (head == tail){
+		return false;
+	}
+	io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+	user_data = cqe->user_data;
+	res = cqe->res;
+	__atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
@@ -82,6 +82,43 @@ int main(int argc, char *argv[]){
         nInfo.push_back(n);
     }
 
+    PeerOptions options;
+    options.reactor_threads = static_cast<unsigned int>(cfg.common.reactorThreads);
+    options.io_backend = (cfg.common.ioBackend == "uring") ? IoBackend::Uring : IoBackend::Posix;
+    options.pipelining = cfg.common.requestPipelining;
+    options.max_outstanding_requests = static_cast<unsigned int>(cfg.common.maxOutstandingRequests);
+    options.block_transfers = cfg.common.blockTransfers;
+    options.block_size = static_cast<unsigned int>(cfg.common.blockSize);
+    options.send_queue_limit = static_cast<size_t>(cfg.common.sendQueueLimit);
+    options.store.mode = (cfg.common.storeMode == "mmap") ? StoreMode::Mmap : StoreMode::Pread;
+    options.store.map_writable = cfg.common.mmapWrite;
+    if (cfg.common.mmapAdvice == "sequential") {
+        options.store.advice = MapAdvice::Sequential;
+    } else if (cfg.common.mmapAdvice == "random") {
+        options.store.advice = MapAdvice::Random;
+    }
+    if (cfg.common.flushPolicy == "piece") {
+        options.store.flush_policy = FlushPolicy::Piece;
+    } else if (cfg.common.flushPolicy == "complete") {
+        options.store.flush_policy = FlushPolicy::Complete;
+    } else {
+        options.store.flush_policy = FlushPolicy::Batch;
+    }
+    options.store.flush_batch = static_cast<unsigned int>(cfg.common.flushBatch);
+    options.verify_pieces = cfg.common.verifyPieces;
+    options.verify_threads = static_cast<unsigned int>(cfg.common.verifyThreads);
+    options.disk_threads = static_cast<unsigned int>(cfg.common.diskThreads);
+    options.disk_queue_depth = static_cast<size_t>(cfg.common.diskQueueDepth);
+    options.cache_size = static_cast<size_t>(cfg.common.cacheSize);
+    options.read_ahead = static_cast<unsigned int>(cfg.common.readAhead);
+    options.pick_policy = (cfg.common.piecePicker == "sequential") ? PickPolicy::Sequential : PickPolicy::RarestFirst;
+    options.endgame = cfg.common.endgame;
+    options.cancel_messages = cfg.common.cancelMessages;
+    options.seed_choking = (cfg.common.seedChoking == "upload") ? SeedChoking::Upload : SeedChoking::Random;
+    options.optimistic_unchoking_interval = static_cast<unsigned int>(cfg.common.optimisticUnchokeIntervalSec);
+    options.snub_timeout = static_cast<unsigned int>(cfg.common.snubTimeoutSec);
+    options.super_seeding = cfg.common.superSeeding;
+
     std::cout << "Starting Peer " << peerId << "..." << std::endl;
     
     P2P_Client client(
@@ -95,7 +132,8 @@ int main(int argc, char *argv[]){
         cfg.common.pieceSizeBytes,
         myInfo.hasFile,
         nInfo,
-		debug
+		debug,
+        options
     );
     
     std::cout << "Peer " << peerId << " is running on port " << myInfo.port << std::endl;
@@ -0,0 +1,118 @@
+#include "Metainfo.hpp"
+#include "WorkerPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char META_MAGIC[8] = {'P', '2', 'P', 'M', 'E', 'T', 'A', '1'};
+
+struct MetaHeader {
+	char magic[8];
+	uint64_t file_size;
+	uint64_t piece_size;
+	uint32_t total_pieces;
+	uint32_t reserved;
+};
+
+Metainfo::Metainfo(size_t file_size, size_t piece_size, int total_pieces)
+	: file_size_(file_size),
+	piece_size_(piece_size),
+	total_pieces_(total_pieces){}
+
+size_t Metainfo::piece_length(int piece_index) const {
+	if (piece_index == total_pieces_ - 1){
+		return file_size_ - static_cast<size_t>(piece_index) * piece_size_;
+	}
+	return piece_size_;
+}
+
+bool Metainfo::load(const std::string& path){
+	FILE* f = std::fopen(path.c_str(), "rb");
+	if (f == nullptr){
+		return false;
+	}
+	MetaHeader h{};
+	std::vector<sha256::Digest> digests(static_cast<size_t>(total_pieces_));
+	bool ok = std::fread(&h, sizeof(h), 1, f) == 1
+		&& std::memcmp(h.magic, META_MAGIC, sizeof(h.magic)) == 0
+		&& h.file_size == file_size_ && h.piece_size == piece_size_
+		&& h.total_pieces == static_cast<uint32_t>(total_pieces_)
+		&& std::fread(digests.data(), sizeof(sha256::Digest), digests.size(), f) == digests.size();
+	std::fclose(f);
+	if (!ok){
+		return false;
+	}
+	digests_ = std::move(digests);
+	return true;
+}
+
+bool Metainfo::generate(int data_fd, const std::string& path, WorkerPool& pool){
+	std::vector<sha256::Digest> digests(static_cast<size_t>(total_pieces_));
+	std::atomic<bool> failed{false};
+
+	//one task per slice of pieces, each reading with its own buffer
+	int slices = static_cast<int>(pool.num_threads()) * 4;
+	int per_slice = (total_pieces_ + slices - 1) / slices;
+	for (int first = 0; first < total_pieces_; first += per_slice){
+		int last = std::min(total_pieces_, first + per_slice);
+		pool.submit([this, data_fd, first, last, &digests, &failed]{
+			std::vector<char> buf(piece_size_);
+			for (int i = first; i < last && !failed; ++i){
+				size_t len = piece_length(i);
+				size_t done = 0;
+				while (done < len){
+					ssize_t r = pread(data_fd, buf.data() + done, len - done, static_cast<off_t>(i) * piece_size_ + done);
+					if (r < 0 && errno == EINTR){
+						continue;
+					}
+					if (r <= 0){
+						failed = true;
+						return;
+					}
+					done += static_cast<size_t>(r);
+				}
+				digests[i] = sha256::hash(buf.data(), len);
+			}
+		});
+	}
+	pool.wait_idle();
+	if (failed){
+		return false;
+	}
+
+	MetaHeader h{};
+	std::memcpy(h.magic, META_MAGIC, sizeof(h.magic));
+	h.file_size = file_size_;
+	h.piece_size = piece_size_;
+	h.total_pieces = static_cast<uint32_t>(total_pieces_);
+
+	//peers starting at the same time must never read a half written file
+	std::string tmp = path + ".tmp";
+	FILE* f = std::fopen(tmp.c_str(), "wb");
+	if (f == nullptr){
+		return false;
+	}
+	bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1
+		&& std::fwrite(digests.data(), sizeof(sha256::Digest), digests.size(), f) == digests.size();
+	ok = (std::fclose(f) == 0) && ok;
+	if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0){
+		std::remove(tmp.c_str());
+		return false;
+	}
+	digests_ = std::move(digests);
+	return true;
+}
+
+bool Metainfo::verify(int piece_index, std::span<const char> piece_data) const {
+	if (piece_index < 0 || piece_index >= total_pieces_ || piece_data.size() != piece_length(piece_index)){
+		return false;
+	}
+	if (digests_.empty()){
+		return true; //nothing to check against
+	}
+	return sha256::hash(piece_data.data(), piece_data.size()) == digests_[piece_index];
+}
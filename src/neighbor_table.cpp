@@ -0,0 +1,117 @@
+#include "NeighborTable.hpp"
+#include "Neighbor.hpp"
+#include <cmath>
+#include <sys/resource.h>
+
+NeighborTable::NeighborTable(size_t capacity)
+	: rows_(capacity, nullptr),
+	peer_id_(capacity, 0),
+	choked_(capacity, 1),
+	interested_(capacity, 0),
+	peer_choking_(capacity, 1),
+	am_interested_(capacity, 0),
+	rate_(capacity, 0.0),
+	down_bytes_(capacity),
+	up_bytes_(capacity),
+	down_rate_(capacity, 0.0),
+	up_rate_(capacity, 0.0),
+	last_active_(capacity),
+	connected_(capacity),
+	in_flight_(capacity, 0){
+	//sockets are numbered below the descriptor limit
+	size_t max_sock = MAX_SOCK;
+	rlimit lim{};
+	if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY && lim.rlim_cur < max_sock){
+		max_sock = static_cast<size_t>(lim.rlim_cur);
+	}
+	slot_of_sock_.assign(max_sock, -1);
+}
+
+NeighborTable::~NeighborTable(){
+	for (size_t s = 0; s < end_; ++s){
+		delete rows_[s]; //closes the socket
+	}
+}
+
+Neighbor* NeighborTable::emplace(int sock, uint16_t port, std::string ip, uint32_t peer_id, bool has_file){
+	if (sock < 0 || static_cast<size_t>(sock) >= slot_of_sock_.size() || slot_of_sock_[sock] >= 0){
+		return nullptr;
+	}
+	int slot = -1;
+	if (!free_.empty()){
+		slot = free_.back();
+		free_.pop_back();
+	} else if (end_ < rows_.size()){
+		slot = static_cast<int>(end_++);
+	} else {
+		return nullptr;
+	}
+
+	peer_id_[slot] = peer_id;
+	choked_[slot] = 1;
+	interested_[slot] = 0;
+	peer_choking_[slot] = 1;
+	am_interested_[slot] = 0;
+	rate_[slot] = 0.0;
+	down_bytes_[slot] = 0;
+	up_bytes_[slot] = 0;
+	down_rate_[slot] = 0.0;
+	up_rate_[slot] = 0.0;
+	connected_[slot] = std::chrono::steady_clock::now();
+	last_active_[slot] = connected_[slot].time_since_epoch().count();
+	in_flight_[slot] = 0;
+
+	Neighbor* n = new Neighbor(*this, slot, sock, port, std::move(ip), has_file);
+	rows_[slot] = n;
+	slot_of_sock_[sock] = slot;
+	slot_of_id_[peer_id] = slot;
+	size_++;
+	return n;
+}
+
+bool NeighborTable::remove(int sock){
+	Neighbor* n = by_sock(sock);
+	if (n == nullptr){
+		return false;
+	}
+	int slot = slot_of_sock_[sock];
+	auto id = slot_of_id_.find(peer_id_[slot]);
+	if (id != slot_of_id_.end() && id->second == slot){
+		slot_of_id_.erase(id);
+	}
+	slot_of_sock_[sock] = -1;
+	rows_[slot] = nullptr;
+	delete n; //closes the socket
+	size_--;
+
+	//trim the scan range rather than leave free slots at the end
+	if (static_cast<size_t>(slot) + 1 == end_){
+		end_--;
+		while (end_ > 0 && rows_[end_ - 1] == nullptr){
+			end_--;
+		}
+		std::erase_if(free_, [this](int s){ return static_cast<size_t>(s) >= end_; });
+	} else {
+		free_.push_back(slot);
+	}
+	return true;
+}
+
+Neighbor* NeighborTable::by_id(uint32_t peer_id) const {
+	auto it = slot_of_id_.find(peer_id);
+	return it == slot_of_id_.end() ? nullptr : rows_[it->second];
+}
+
+void NeighborTable::sample_rates(double seconds, double window){
+	if (seconds <= 0 || window <= 0){
+		return;
+	}
+	double weight = 1.0 - std::pow(0.4, seconds / window);
+	for (size_t s = 0; s < end_; ++s){
+		double down = static_cast<double>(down_bytes_[s].exchange(0, std::memory_order_relaxed)) / seconds;
+		double up = static_cast<double>(up_bytes_[s].exchange(0, std::memory_order_relaxed)) / seconds;
+		//the last window counts most, older ones smooth out a single slow interval
+		down_rate_[s] = weight * down + (1.0 - weight) * down_rate_[s];
+		up_rate_[s] = weight * up + (1.0 - weight) * up_rate_[s];
+	}
+}
@@ -0,0 +1,276 @@
+#include "OutQueue.hpp"
+#include <cerrno>
+#include <climits>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+void OutQueue::set_limit(size_t limit){
+	std::lock_guard<std::mutex> lck(mu_);
+	limit_ = limit;
+}
+
+void OutQueue::set_write_interest(WriteInterest cb){
+	std::lock_guard<std::mutex> lck(mu_);
+	on_interest_ = std::move(cb);
+}
+
+//asks for EPOLLOUT, the writes themselves happen on the thread that owns the socket
+void OutQueue::arm(){
+	if (!armed_){
+		armed_ = true;
+		if (on_interest_){
+			on_interest_(true);
+		}
+	}
+}
+
+bool OutQueue::push(std::vector<char> bytes){
+	std::lock_guard<std::mutex> lck(mu_);
+	if (failed_){
+		return false;
+	}
+	if (bytes.empty()){
+		return true;
+	}
+	queued_ += bytes.size();
+	//small frames share an entry so a burst of HAVEs still leaves in a single sendmsg
+	if (!control_.empty() && control_.back().sent == 0 && control_.back().bytes.size() < 4096){
+		std::vector<char>& tail = control_.back().bytes;
+		tail.insert(tail.end(), bytes.begin(), bytes.end());
+	} else {
+		Entry e;
+		e.bytes = std::move(bytes);
+		control_.push_back(std::move(e));
+	}
+	arm();
+	return true;
+}
+
+bool OutQueue::push_file(std::vector<char> head, int file_fd, off_t offset, size_t len){
+	std::lock_guard<std::mutex> lck(mu_);
+	if (failed_){
+		return false;
+	}
+	Entry e;
+	queued_ += head.size() + len;
+	e.bytes = std::move(head);
+	e.file_fd = file_fd;
+	e.offset = offset;
+	e.body_len = len;
+	bulk_.push_back(std::move(e));
+	arm();
+	return true;
+}
+
+bool OutQueue::push_mapped(std::vector<char> head, const char* body, size_t len){
+	std::lock_guard<std::mutex> lck(mu_);
+	if (failed_){
+		return false;
+	}
+	Entry e;
+	queued_ += head.size() + len;
+	e.bytes = std::move(head);
+	e.mapped = body;
+	e.body_len = len;
+	bulk_.push_back(std::move(e));
+	arm();
+	return true;
+}
+
+bool OutQueue::push_shared(std::vector<char> head, std::shared_ptr<const std::vector<char>> owner, size_t begin, size_t len){
+	std::lock_guard<std::mutex> lck(mu_);
+	if (failed_){
+		return false;
+	}
+	Entry e;
+	queued_ += head.size() + len;
+	e.bytes = std::move(head);
+	e.mapped = owner->data() + begin;
+	e.owner = std::move(owner);
+	e.body_len = len;
+	bulk_.push_back(std::move(e));
+	arm();
+	return true;
+}
+
+size_t OutQueue::discard_bulk(){
+	std::lock_guard<std::mutex> lck(mu_);
+	size_t dropped = 0;
+	auto it = bulk_.begin();
+	while (it != bulk_.end()){
+		if (it->sent == 0){
+			dropped += it->bytes.size() + it->body_len;
+			it = bulk_.erase(it);
+		} else {
+			++it;
+		}
+	}
+	queued_ -= dropped;
+	return dropped;
+}
+
+bool OutQueue::discard_unsent(const std::vector<char>& head){
+	std::lock_guard<std::mutex> lck(mu_);
+	for (auto it = bulk_.begin(); it != bulk_.end(); ++it){
+		if (it->sent == 0 && it->bytes == head){
+			queued_ -= it->bytes.size() + it->body_len;
+			bulk_.erase(it);
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t OutQueue::queued() const {
+	std::lock_guard<std::mutex> lck(mu_);
+	return queued_;
+}
+
+bool OutQueue::congested() const {
+	std::lock_guard<std::mutex> lck(mu_);
+	return queued_ >= limit_;
+}
+
+OutQueue::Status OutQueue::send_entry(int sock, Entry& e, size_t& budget){
+	while (e.sent < e.bytes.size()){
+		//MSG_MORE keeps the header in the same segment as the start of a spliced body
+		int flags = MSG_NOSIGNAL | MSG_DONTWAIT | (e.body_len > 0 ? MSG_MORE : 0);
+		ssize_t s = send(sock, e.bytes.data() + e.sent, e.bytes.size() - e.sent, flags);
+		if (s < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? Status::Pending : Status::Failed;
+		}
+		e.sent += static_cast<size_t>(s);
+		queued_ -= static_cast<size_t>(s);
+	}
+
+	while (e.sent < e.bytes.size() + e.body_len){
+		if (budget == 0){
+			return Status::Pending;
+		}
+		size_t done = e.sent - e.bytes.size();
+		size_t want = e.body_len - done;
+		want = want < SEND_SLICE ? want : SEND_SLICE;
+		want = want < budget ? want : budget;
+
+		off_t offset = e.offset + static_cast<off_t>(done);
+		ssize_t s = e.mapped ? send(sock, e.mapped + done, want, MSG_NOSIGNAL | MSG_DONTWAIT)
+		                     : sendfile(sock, e.file_fd, &offset, want);
+		if (s < 0 && !e.mapped && (errno == EINVAL || errno == ENOSYS)){
+			//file system can't do sendfile, turn the rest of the range into plain bytes
+			std::vector<char> rest(e.body_len - done);
+			size_t got = 0;
+			while (got < rest.size()){
+				ssize_t r = pread(e.file_fd, rest.data() + got, rest.size() - got, offset + static_cast<off_t>(got));
+				if (r < 0 && errno == EINTR){
+					continue;
+				}
+				if (r <= 0){
+					return Status::Failed;
+				}
+				got += static_cast<size_t>(r);
+			}
+			e.bytes = std::move(rest);
+			e.sent = 0;
+			e.file_fd = -1;
+			e.body_len = 0;
+			return send_entry(sock, e, budget);
+		}
+		if (s < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? Status::Pending : Status::Failed;
+		}
+		if (s == 0){
+			return Status::Failed; //file is shorter than expected
+		}
+		e.sent += static_cast<size_t>(s);
+		queued_ -= static_cast<size_t>(s);
+		budget -= static_cast<size_t>(s);
+	}
+	return Status::Drained;
+}
+
+//every queued control frame in one sendmsg (or as many as the socket takes)
+OutQueue::Status OutQueue::send_control(int sock){
+	while (!control_.empty()){
+		std::vector<iovec> iov;
+		for (auto& e : control_){
+			if (iov.size() == IOV_MAX){
+				break;
+			}
+			iov.push_back(iovec{e.bytes.data() + e.sent, e.bytes.size() - e.sent});
+		}
+		msghdr msg{};
+		msg.msg_iov = iov.data();
+		msg.msg_iovlen = iov.size();
+		ssize_t s = sendmsg(sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (s < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? Status::Pending : Status::Failed;
+		}
+		size_t left = static_cast<size_t>(s);
+		queued_ -= left;
+		while (left > 0){
+			Entry& e = control_.front();
+			size_t rest = e.bytes.size() - e.sent;
+			if (left < rest){
+				e.sent += left;
+				break;
+			}
+			left -= rest;
+			control_.pop_front();
+		}
+	}
+	return Status::Drained;
+}
+
+OutQueue::Status OutQueue::flush(int sock){
+	std::lock_guard<std::mutex> lck(mu_);
+	if (failed_){
+		return Status::Failed;
+	}
+
+	size_t budget = FLUSH_BUDGET;
+	while (!control_.empty() || !bulk_.empty()){
+		Status st = Status::Drained;
+		bool mid_frame = !bulk_.empty() && bulk_.front().sent > 0;
+		if (!control_.empty() && !mid_frame){
+			st = send_control(sock);
+		} else if (budget == 0){
+			st = Status::Pending; //yield, level-triggered EPOLLOUT brings us straight back
+		} else {
+			st = send_entry(sock, bulk_.front(), budget);
+			if (st == Status::Drained){
+				bulk_.pop_front();
+			}
+		}
+
+		if (st == Status::Failed){
+			failed_ = true;
+			control_.clear();
+			bulk_.clear();
+			queued_ = 0;
+			return st;
+		}
+		if (st == Status::Pending){
+			arm(); //in case the caller wasn't the EPOLLOUT handler
+			return st;
+		}
+	}
+
+	if (armed_){
+		armed_ = false;
+		if (on_interest_){
+			on_interest_(false);
+		}
+	}
+	return Status::Drained;
+}
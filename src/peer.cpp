@@ -1,9 +1,10 @@
 #include "Peer.hpp"
+#include <sys/stat.h>
 #include "Header.hpp"
 #include "Neighbor.hpp"
-#include "config.h"
 #include <cstddef>
 #include <cstdint>
+#include <algorithm>
 #include <map>
 #include <string>
 #include <arpa/inet.h>
@@ -16,21 +17,16 @@
 #include <netdb.h>
 #include <vector>
 
+//callers must not hold peers_mu_
 Neighbor* P2P_Client::find_neighbor_by_id(uint32_t id){
-	for (auto* n : neighbors_){
-      		if (n->peer_id() == id){
-			return n;
-      		}
-	}
-      	return nullptr;
+	std::lock_guard<std::mutex> lck(peers_mu_);
+	return neighbors_->by_id(id);
 }
 
+//no lock: called on the socket's own reactor thread (or before the reactor watches it), and only
+//that thread removes the neighbor
 Neighbor* P2P_Client::find_neighbor_by_sock(int sock){
-	auto it = sock_to_peer_.find(sock);
-	if (it == sock_to_peer_.end()){
-		return nullptr;
-	}
-	return find_neighbor_by_id(it->second);
+	return neighbors_->by_sock(sock);
 }
       
 int P2P_Client::listen_on(){
@@ -96,6 +92,46 @@ void P2P_Client::stop_listening() {
 }
 
 
+//the handshake is the only thing written and read outside the reactor, on a still blocking socket
+static bool read_exact(int sock, void* buf, size_t size){
+	char* m_buf = static_cast<char*>(buf);
+	size_t chars_left = size;
+
+	while (chars_left > 0){
+		ssize_t r = recv(sock, m_buf, chars_left, 0);
+		if (r == 0) {
+			return false; //peers connection closed
+		}
+		if (r < 0){
+			if (errno == EINTR){ //connection interrupted
+				continue;
+			}
+			return false;
+		}
+		m_buf += r; //move pointer forward
+		chars_left -= static_cast<size_t>(r);
+	}
+	return true;
+}
+
+static bool send_exact(int sock, const void* buf, size_t size){
+	const char* m_buf = static_cast<const char*>(buf);
+	size_t chars_left = size;
+
+	while (chars_left > 0){
+		ssize_t s = send(sock, m_buf, chars_left, MSG_NOSIGNAL);
+		if (s < 0 && errno == EINTR){
+			continue;
+		}
+		if (s <= 0){
+			return false;
+		}
+		m_buf += s;
+		chars_left -= static_cast<size_t>(s);
+	}
+	return true;
+}
+
 int P2P_Client::connect_to(std::string peer_ip, uint16_t peer_port){
 	
 	addrinfo hints{};
@@ -131,33 +167,71 @@ int P2P_Client::connect_to(std::string peer_ip, uint16_t peer_port){
 }
 
 
-bool P2P_Client::send_message(uint8_t type, const void* payload, uint32_t payload_len, int sock){
-	const uint32_t length = 1 + payload_len;
-	if (length < 1) {
+//queues one frame for the neighbor, safe from any thread and never waits on the socket
+//the reactor thread that owns the socket writes it out once it is writable
+bool P2P_Client::send_message(uint8_t type, const void* payload, uint32_t payload_len, Neighbor* n){
+	if (payload_len > 0 && payload == nullptr){
 		return false;
 	}
-	uint32_t nlen = htonl(length);
-	
-	//send 4 byte length
-	if (!send_exact(sock, &nlen, sizeof(nlen))){
+	FrameBatch batch;
+	batch.add(type, payload, payload_len);
+	std::vector<char> bytes;
+	batch.append_to(bytes);
+	return n->outbox().push(std::move(bytes));
+}
+
+//queues the batch and writes what the socket takes right away
+//only for the reactor thread that owns the neighbor's socket, other threads use send_message
+bool P2P_Client::send_frames(Neighbor* n, FrameBatch& batch){
+	std::vector<char> bytes;
+	batch.append_to(bytes);
+	if (!n->outbox().push(std::move(bytes))){
 		return false;
 	}
+	return n->outbox().flush(n->sock()) != OutQueue::Status::Failed;
+}
+
+//queues the same frame for every neighbor (except skip_sock)
+//peers_mu_ is only held while copying into the queues, the sends happen on each socket's own thread
+void P2P_Client::broadcast_message(uint8_t type, const void* payload, uint32_t payload_len, int skip_sock){
+	FrameBatch batch;
+	batch.add(type, payload, payload_len);
+	std::vector<char> frame;
+	batch.append_to(frame);
 
-	// send 1 byte type
-	if (!send_exact(sock, &type, sizeof(type))){
+	std::lock_guard<std::mutex> lck(peers_mu_);
+	neighbors_->for_each([&](Neighbor* n){
+		if (n->sock() == skip_sock){
+			return;
+		}
+		if (!n->outbox().push(frame)){
+			debug_message("Failed to send message to peer: " + std::to_string(n->peer_id()));
+			logger_->event("ERROR", "Failed to send message to peer: " + std::to_string(n->peer_id()));
+		}
+	});
+}
+
+//EPOLLOUT: writes queued frames, then answers requests held back while the queue was full
+bool P2P_Client::on_writable(int sock){
+	Neighbor* n = find_neighbor_by_sock(sock);
+	if (n == nullptr){
+		return false;
+	}
+	if (n->outbox().flush(sock) == OutQueue::Status::Failed){
 		return false;
 	}
 
-	// send variable length payload (payload can be empty)
-	if (payload_len > 0){
-		if (payload == nullptr){
-			return false;
-		}
-		if (!send_exact(sock, payload, payload_len)){
+	if (n->outbox().congested()){
+		return true;
+	}
+	for (const auto& r : n->take_deferred()){
+		if (n->outbox().congested()){
+			n->defer_request(r.piece, r.begin, r.length);
+		} else if (!n->choked() && !serve_request(n, r.piece, r.begin, r.length)){
 			return false;
 		}
 	}
-	return true;
+	return n->outbox().flush(sock) != OutQueue::Status::Failed;
 }
 
 //convert a char buffer to a string
@@ -171,33 +245,43 @@ static std::string convert_to_string(const char* buf, size_t size){
 }
 
 //read the actual messages from peer
+//called by the reactor whenever the socket is readable, dispatches every frame that has fully arrived
 bool P2P_Client::read_message(int sock){
-	//read in 4 byte message length
-	uint32_t t_len;
-	if (!read_exact(sock, &t_len, sizeof(t_len))){
-		return false;
-	}
-	uint32_t m_length = ntohl(t_len); //fix order
-	
-	if (m_length < 1){
+	Neighbor* n = find_neighbor_by_sock(sock);
+	if (n == nullptr){
 		return false;
 	}
-	uint32_t payload_length = m_length - 1;
-	
 
-	//read in 1 byte message type
-	uint8_t type = 0;	
-	if (!read_exact(sock, &type, sizeof(type))){
-		return false;
-	}
-		
-	//read in payload if applicable
-	std::vector<char> payload(payload_length);
-	if (payload_length > 0){
-		if (!read_exact(sock, payload.data(), payload.size())){
+	//one recv() per pass, then every frame that is complete in the buffer
+	RecvBuffer& inbox = n->inbox();
+	while (true){
+		bool full = false;
+		int r = inbox.fill(sock, full);
+		if (r < 0){
 			return false;
 		}
+
+		FrameView frame;
+		int f = 0;
+		while ((f = inbox.next(frame)) > 0){
+			if (!handle_message(sock, frame)){
+				return false;
+			}
+		}
+		if (f < 0){
+			return false;
+		}
+
+		//a short read drained the socket, epoll will tell us when there is more
+		if (r == 0 || !full){
+			return true;
+		}
 	}
+}
+
+bool P2P_Client::handle_message(int sock, const FrameView& frame){
+	uint8_t type = frame.type;
+	std::span<const char> payload = frame.payload;
 
 	if (type == CHOKE){//choke
 		return read_choke(sock);
@@ -224,9 +308,10 @@ bool P2P_Client::read_message(int sock){
 		return read_bitfield(sock, payload);
 
 	}
+	else if (type == CANCEL){//cancel
+		return read_cancel(sock, payload);
+	}
 	return false;
-	
-	
 }
 
 int P2P_Client::start_listening() {
@@ -255,6 +340,7 @@ bool P2P_Client::send_handshake(int sock, uint32_t peer_id){
 	char buf[32];
 	std::memcpy(buf, f, 18); //P2PFILESHARINGPROJ
 	std::memset(buf+18, 0, 10); //zeros
+	buf[HANDSHAKE_EXT_BYTE] = static_cast<char>(extensions_); //stays zero unless an extension is enabled
 	uint32_t net_peer_id = htonl(peer_id);
 	std::memcpy(buf+28, &net_peer_id, 4);
 
@@ -279,11 +365,13 @@ bool P2P_Client::read_handshake(int sock, std::string ip, uint16_t other_port, u
 		return false;
 	}
 
-	for (char c: zero_buf){
-		if (c != 0){
+	//the last reserved byte carries extension flags, the rest must still be zero
+	for (size_t i = 0; i + 1 < sizeof(zero_buf); ++i){
+		if (zero_buf[i] != 0){
 		      return false;
 		}
 	}
+	uint8_t ext = static_cast<uint8_t>(zero_buf[sizeof(zero_buf) - 1]) & extensions_;
 
 	char id_buf[4];
 	if (!read_exact(sock, id_buf, sizeof(id_buf))){
@@ -300,7 +388,7 @@ bool P2P_Client::read_handshake(int sock, std::string ip, uint16_t other_port, u
 
 	{
 		std::lock_guard<std::mutex> lck(peers_mu_);
-		sock_to_peer_[sock] = peer_id;
+		sock_ext_[sock] = ext;
 	}
 
 	//return on_new_connection(sock, ip, other_port, expected_peer_id, has_file);
@@ -308,7 +396,7 @@ bool P2P_Client::read_handshake(int sock, std::string ip, uint16_t other_port, u
 }
 
 
-bool P2P_Client::read_handshake(int sock, std::string ip, uint16_t other_port){
+bool P2P_Client::read_handshake(int sock, std::string ip, uint16_t other_port, uint32_t& peer_id){
 	char start_buf[18];
 	if (!read_exact(sock, start_buf, 18)){
 		return false;
@@ -325,11 +413,13 @@ bool P2P_Client::read_handshake(int sock, std::string ip, uint16_t other_port){
 		return false;
 	}
 
-	for (char c : zero_buf){
-		if (c != 0){
+	//the last reserved byte carries extension flags, the rest must still be zero
+	for (size_t i = 0; i + 1 < sizeof(zero_buf); ++i){
+		if (zero_buf[i] != 0){
 		      return false;
 		}
 	}
+	uint8_t ext = static_cast<uint8_t>(zero_buf[sizeof(zero_buf) - 1]) & extensions_;
 
 	char id_buf[4];
 	if (!read_exact(sock, id_buf, sizeof(id_buf))){
@@ -338,20 +428,13 @@ bool P2P_Client::read_handshake(int sock, std::string ip, uint16_t other_port){
 	uint32_t net_peer_id = 0;
 	std::memcpy(&net_peer_id, id_buf, 4);
 
-	uint32_t peer_id = ntohl(net_peer_id);
-
-	bool init_has_file = false;
+	peer_id = ntohl(net_peer_id);
 
 	{
 		std::lock_guard<std::mutex> lck(peers_mu_);
-		auto it = neighbor_has_file.find(peer_id);
-		if (it != neighbor_has_file.end()){
-			init_has_file = it->second;
-		}
-		sock_to_peer_[sock] = peer_id;
+		sock_ext_[sock] = ext;
 	}
 
-	//return on_new_connection(sock, ip, other_port, peer_id, init_has_file);
 	return true;
 	
 }
@@ -359,21 +442,43 @@ bool P2P_Client::read_handshake(int sock, std::string ip, uint16_t other_port){
 
 void P2P_Client::addNeighbor(int sock, std::string ip, uint16_t port, uint32_t peer_id, bool has_file){
 	std::lock_guard<std::mutex> l(peers_mu_); //lock the peers vector (THIS IS IMPORTANT FOR THREADING)
-	neighbors_.push_back(new Neighbor(sock, port,ip, peer_id, has_file));
+	Neighbor* n = neighbors_->emplace(sock, port, ip, peer_id, has_file);
+	if (n == nullptr){
+		logger_->event("ERROR", "No room for peer " + std::to_string(peer_id) + " on socket " + std::to_string(sock) + ".");
+		return;
+	}
+	auto retry = reconnects_.find(peer_id);
+	if (retry != reconnects_.end()){
+		timers_->cancel(retry->second); //they reached us first
+		reconnects_.erase(retry);
+	}
+	n->init_bitfield(total_pieces_); //HAVEs count even if no BITFIELD comes first
+	n->inbox().set_max_frame(max_frame_);
+	n->outbox().set_limit(options_.send_queue_limit);
+	n->outbox().set_write_interest([this, sock](bool on){ reactor_->set_writable(sock, on); });
+	auto ext = sock_ext_.find(sock);
+	if (ext != sock_ext_.end()){
+		n->set_extensions(ext->second);
+		sock_ext_.erase(ext);
+	}
 }
 
 bool P2P_Client::on_new_connection(int sock, std::string ip, uint16_t port, uint32_t peer_id, bool has_file){
 	addNeighbor(sock, ip, port, peer_id, has_file);	
-	//once connnection is established send bitfield message
+	Neighbor* n = find_neighbor_by_sock(sock);
+	if (n == nullptr){
+		return false;
+	}
+	//once connnection is established send bitfield message (written once the reactor watches the socket)
 	
-	uint32_t bitfield_len = bitfield_.size();
-	if (!send_message(BITFIELD, bitfield_.data(), bitfield_len, sock)){
+	//a super-seed shows nothing, its pieces are revealed one at a time once their BITFIELD is in
+	std::vector<uint8_t> bits = super_seeding_ ? std::vector<uint8_t>((total_pieces_ + 7) / 8, 0) : bitfield_.to_bytes();
+	if (!send_message(BITFIELD, bits.data(), static_cast<uint32_t>(bits.size()), n)){
 		return false;
 	}
 
 	logger_->line("Peer " + std::to_string(my_peer_id_) + " connected to Peer " + std::to_string(peer_id) + ".");
-	start_peer_message_loop(sock);
-	return true;
+	return watch_connection(sock);
 	
 }
 
@@ -409,15 +514,16 @@ void P2P_Client::accept_loop(){
 		
 		std::string ip = std::string(ip_str);
 
-		if (!read_handshake(cfd, ip, other_port)){
+		uint32_t remote_peer_id = 0;
+		if (!read_handshake(cfd, ip, other_port, remote_peer_id)){
 			close(cfd);
 			continue;
 		}
 		if (!send_handshake(cfd, my_peer_id_)){
 			close(cfd);
+			continue;
 		}
 
-		uint32_t remote_peer_id = sock_to_peer_[cfd];
 		bool has_file = false;
 		on_new_connection(cfd, ip, other_port, remote_peer_id, has_file);
 	}
@@ -451,23 +557,11 @@ bool P2P_Client::read_choke(int sock){
 	if (n == nullptr){
 		return false;
 	}
-	n->set_choked(true);
+	n->set_peer_choking(true);
+	release_requests(n); //a choking peer drops whatever we had asked for
 	logger_->line("Peer " + std::to_string(my_peer_id_) 
 		+ " received the 'choke' message from peer " 
 		+ std::to_string(n->peer_id()) + ".");
-	
-	{
-        std::lock_guard<std::mutex> lock(peers_mu_);
-        auto it = piece_to_peer_.begin();
-        while (it != piece_to_peer_.end()) {
-            if (it->second == n->peer_id()) {
-                requested_pieces_.erase(it->first);
-                it = piece_to_peer_.erase(it);
-            } else {
-                ++it;
-            }
-        }
-    }
 	return true;
 }
 
@@ -476,15 +570,17 @@ bool P2P_Client::read_unchoke(int sock){
 	if (n == nullptr){
 		return false;
 	}
-	n->set_choked(false);
+	n->set_peer_choking(false);
+	n->mark_active();
 
 	logger_->line("Peer " + std::to_string(my_peer_id_) 
 		+ " received the 'unchoke' message from peer " 
 		+ std::to_string(n->peer_id()) + ".");
 	
-	request_next_piece(sock);
+	FrameBatch out;
+	request_next_piece(sock, out);
 
-	return true;
+	return send_frames(n, out);
 }
 
 bool P2P_Client::read_interested(int sock){
@@ -513,7 +609,7 @@ bool P2P_Client::read_uninterested(int sock){
 	return true;
 }
 
-bool P2P_Client::read_have(int sock, std::vector<char> buf){
+bool P2P_Client::read_have(int sock, std::span<const char> buf){
 	if (buf.size() < 4){
 		return false;
 	}
@@ -530,29 +626,48 @@ bool P2P_Client::read_have(int sock, std::vector<char> buf){
 	if (n == nullptr){
 		return false;
 	}
-	n->set_piece(piece_index, true);
+	if (n->set_piece(piece_index, true)){
+		picker_->on_have(piece_index);
+	}
+	if (n->pieces().all()){
+		n->set_has_file(true);
+	}
 	logger_->line("Peer " + std::to_string(my_peer_id_) 
 		+ " received the 'have' message from peer " 
 		+ std::to_string(n->peer_id()) 
 		+ " for piece " + std::to_string(piece_index) + ".");
+	if (super_seeding_){
+		super_seed_have(n, piece_index);
+	}
 	
 	bool need_piece = !has_piece(piece_index);
-	bool already_interested = n->interested();
+	bool already_interested = n->am_interested();
 
 	if (need_piece && !already_interested){
-		if (!send_message(INTERESTED, nullptr, 0, sock)){
+		if (!send_message(INTERESTED, nullptr, 0, n)){
 			return false;
 		}
-		n->set_interested(true);
+		n->set_am_interested(true);
 		logger_->line("Peer " + std::to_string(my_peer_id_) 
 			+ " sent the 'interested' message to peer " 
 			+ std::to_string(n->peer_id()) + ".");
 	}
+	//an unchoking neighbor we had run out of pieces to ask for (a super-seed reveals them like this)
+	if (need_piece && !n->peer_choking()){
+		FrameBatch out;
+		request_next_piece(sock, out);
+		return send_frames(n, out);
+	}
 	return true;
 }
 
-bool P2P_Client::read_request(int sock, std::vector<char> buf){
-	if (buf.size() < 4){
+bool P2P_Client::read_request(int sock, std::span<const char> buf){
+	Neighbor* n = find_neighbor_by_sock(sock);
+	if (n == nullptr){
+		return false;
+	}
+	bool blocks = n->supports(EXT_BLOCKS);
+	if (buf.size() < (blocks ? 12u : 4u)){
 		return false;
 	}
 
@@ -562,18 +677,21 @@ bool P2P_Client::read_request(int sock, std::vector<char> buf){
 	if ( piece_index < 0 || piece_index >= total_pieces_){
 		return false;
 	}
-	
-	Neighbor* n = find_neighbor_by_sock(sock);
-	if (n == nullptr){
-		return false;
+
+	//whole piece unless the request names a block (begin, length) inside it
+	uint32_t begin = 0;
+	uint32_t length = static_cast<uint32_t>(piece_length(piece_index));
+	if (blocks){
+		uint32_t begin_net = 0;
+		uint32_t length_net = 0;
+		std::memcpy(&begin_net, buf.data() + 4, 4);
+		std::memcpy(&length_net, buf.data() + 8, 4);
+		begin = ntohl(begin_net);
+		length = ntohl(length_net);
+		if (length == 0 || begin >= piece_length(piece_index) || length > piece_length(piece_index) - begin){
+			return false;
+		}
 	}
-	
-	std::vector<char> piece_data;
-    if (!read_piece_from_file(piece_index, piece_data)) {
-		logger_->event("ERROR", "Failed to read piece " + std::to_string(piece_index) + " from file for peer " + std::to_string(n->peer_id()) + ".");
-		debug_message("Failed to read piece " + std::to_string(piece_index) + " from file");
-        return false;
-    }
 
 	if (n->choked()){
 		debug_message("Peer " + std::to_string(my_peer_id_) + " received a request for piece " + std::to_string(piece_index) 
@@ -582,12 +700,59 @@ bool P2P_Client::read_request(int sock, std::vector<char> buf){
 		return true;
 	}
 
-	std::vector<char> payload(4 + piece_data.size());
-	uint32_t piece_net = htonl(static_cast<uint32_t>(piece_index));
-	std::memcpy(payload.data(), &piece_net, 4);
-    std::memcpy(payload.data() + 4, piece_data.data(), piece_data.size());
+	if (!has_piece(piece_index)){
+		debug_message("Peer " + std::to_string(n->peer_id()) + " requested piece " + std::to_string(piece_index) + " which we do not have.");
+		return true;
+	}
 
-	if (!send_message(PIECE, payload.data(), payload.size(), sock)) {
+	//backpressure: a neighbor that isn't reading what we already queued waits for its answer
+	if (n->outbox().congested()){
+		n->defer_request(piece_index, begin, length);
+		return true;
+	}
+	if (!serve_request(n, piece_index, begin, length)){
+		return false;
+	}
+	return n->outbox().flush(sock) != OutQueue::Status::Failed;
+}
+
+//header of the PIECE frame answering a request (also how a queued answer is found again on CANCEL)
+std::vector<char> P2P_Client::piece_head(Neighbor* n, int piece_index, uint32_t begin, uint32_t length) const {
+	uint32_t prefix[2] = {htonl(static_cast<uint32_t>(piece_index)), htonl(begin)};
+	uint32_t prefix_len = n->supports(EXT_BLOCKS) ? 8 : 4;
+	FrameBatch head;
+	head.add_head(PIECE, prefix_len + length, prefix, prefix_len);
+	std::vector<char> bytes;
+	head.append_to(bytes);
+	return bytes;
+}
+
+//queues a PIECE frame: the header goes in the queue, the data stays in the file (or mapping) until it is sent
+bool P2P_Client::serve_request(Neighbor* n, int piece_index, uint32_t begin, uint32_t length){
+	std::vector<char> bytes = piece_head(n, piece_index, begin, length);
+
+	off_t offset = static_cast<off_t>(piece_index) * piece_size_ + begin;
+	const char* mapped = store_->mapped(piece_index);
+	PieceCache::Piece cached = (!mapped && cache_) ? cache_->get(piece_index) : nullptr;
+	bool queued = false;
+	if (mapped){
+		queued = n->outbox().push_mapped(std::move(bytes), mapped + begin, length);
+	} else if (cached){
+		queued = n->outbox().push_shared(std::move(bytes), cached, begin, length);
+	} else {
+		queued = n->outbox().push_file(std::move(bytes), store_->fd(), offset, length);
+		if (cache_){
+			fill_cache(piece_index); //more requests for it are likely to follow
+		}
+	}
+	if (cache_ && !mapped && begin == 0){
+		read_ahead(n, piece_index); //once per piece, not for each of its blocks
+	}
+	if (queued){
+		n->add_sent(length);
+		uploaded_ += length;
+	}
+	if (!queued){
 		logger_->event("ERROR", "Failed to send piece " + std::to_string(piece_index) + " to peer " + std::to_string(n->peer_id()) + ".");
 		debug_message("Failed to send piece " + std::to_string(piece_index) + " to peer " + std::to_string(n->peer_id()));
 
@@ -597,8 +762,103 @@ bool P2P_Client::read_request(int sock, std::vector<char> buf){
 	return true;
 }
 
-bool P2P_Client::read_piece(int sock, std::vector<char> buf){
-	if (buf.size() < 4){
+//they no longer want a piece (or block) they asked for: forget it if it is still held back, or drop
+//its PIECE frame if it is queued but not started. anything already on the wire just finishes
+bool P2P_Client::read_cancel(int sock, std::span<const char> buf){
+	Neighbor* n = find_neighbor_by_sock(sock);
+	if (n == nullptr){
+		return false;
+	}
+	bool blocks = n->supports(EXT_BLOCKS);
+	if (buf.size() < (blocks ? 12u : 4u)){
+		return false;
+	}
+	uint32_t piece_index_net = 0;
+	std::memcpy(&piece_index_net, buf.data(), 4);
+	int piece_index = static_cast<int>(ntohl(piece_index_net));
+	if (piece_index < 0 || piece_index >= total_pieces_){
+		return false;
+	}
+	uint32_t begin = 0;
+	uint32_t length = static_cast<uint32_t>(piece_length(piece_index));
+	if (blocks){
+		uint32_t begin_net = 0;
+		uint32_t length_net = 0;
+		std::memcpy(&begin_net, buf.data() + 4, 4);
+		std::memcpy(&length_net, buf.data() + 8, 4);
+		begin = ntohl(begin_net);
+		length = ntohl(length_net);
+	}
+
+	if (!n->cancel_deferred(piece_index, begin)){
+		n->outbox().discard_unsent(piece_head(n, piece_index, begin, length));
+	}
+	debug_message("Peer " + std::to_string(n->peer_id()) + " cancelled its request for piece " + std::to_string(piece_index));
+	return true;
+}
+
+//reads a piece into the cache on a disk thread (unless it is cached or being read already)
+void P2P_Client::fill_cache(int piece_index){
+	if (!cache_->begin_fill(piece_index)){
+		return;
+	}
+	disk_pool_->submit([this, piece_index]{
+		BufferPool::Buffer data = buffers_->acquire(piece_length(piece_index));
+		bool ok = read_piece_from_file(piece_index, *data);
+		cache_->end_fill(piece_index, ok ? std::move(data) : nullptr);
+	});
+}
+
+//guesses what this neighbor requests after piece_index among the pieces it lacks (and we have). with
+//sequential picking those are the lowest ones, with rarest-first the ones the fewest neighbors have (by
+//our counts, close to the neighbor's own view). rarest-first breaks ties at random, so that guess is
+//only right part of the time
+void P2P_Client::read_ahead(Neighbor* n, int piece_index){
+	std::vector<int> next;
+	if (options_.pick_policy == PickPolicy::Sequential){
+		for (long i = Bitfield::first_and_not(bitfield_, n->pieces(), piece_index + 1); i >= 0 && next.size() < options_.read_ahead;
+			i = Bitfield::first_and_not(bitfield_, n->pieces(), i + 1)){
+			next.push_back(static_cast<int>(i));
+		}
+	} else {
+		next = picker_->rarest_missing(bitfield_, n->pieces(), options_.read_ahead, piece_index);
+	}
+	for (int i : next){
+		fill_cache(i);
+	}
+}
+
+void P2P_Client::log_memory_stats(bool to_log){
+	BufferPool::Stats bs = buffers_->stats();
+	std::string pool_msg = "Piece buffers: " + std::to_string(bs.reused) + " reused, " + std::to_string(bs.allocated)
+		+ " pooled, " + std::to_string(bs.unpooled) + " one-off allocations.";
+	if (to_log){
+		logger_->event("INFO", pool_msg);
+	}
+	debug_message(pool_msg);
+
+	if (!cache_){
+		return;
+	}
+	PieceCache::Stats st = cache_->stats();
+	uint64_t lookups = st.hits + st.misses;
+	std::string msg = "Piece cache: " + std::to_string(st.hits) + " hits, " + std::to_string(st.misses) + " misses ("
+		+ std::to_string(lookups ? st.hits * 100 / lookups : 0) + "% hit rate), " + std::to_string(st.evictions) + " evictions, "
+		+ std::to_string(st.fills) + " disk reads, " + std::to_string(st.pieces) + " pieces / " + std::to_string(st.bytes)
+		+ " of " + std::to_string(cache_->budget()) + " bytes in use.";
+	if (to_log){
+		logger_->event("INFO", msg);
+	}
+	debug_message(msg);
+}
+
+bool P2P_Client::read_piece(int sock, std::span<const char> buf){
+	Neighbor* n = find_neighbor_by_sock(sock);
+	if (n == nullptr){
+		return false;
+	}
+	bool blocks = n->supports(EXT_BLOCKS);
+	if (buf.size() < (blocks ? 8u : 4u)){
 		return false;
 	}
 
@@ -613,383 +873,1028 @@ bool P2P_Client::read_piece(int sock, std::vector<char> buf){
 		return false;
 	}
 
-	std::vector<char> piece_data(buf.begin() + 4, buf.end());
+	uint32_t begin = 0;
+	if (blocks){
+		uint32_t begin_net = 0;
+		std::memcpy(&begin_net, buf.data() + 4, 4);
+		begin = ntohl(begin_net);
+	}
+	std::span<const char> piece_data = buf.subspan(blocks ? 8 : 4); //written straight out of the receive buffer
+	PendingRequest requested{};
+	bool in_flight = n->on_piece_received(piece_index, begin, piece_data.size(), requested);
+	if (!in_flight && !n->take_withdrawn(piece_index, begin, requested)){
+		logger_->event("WARNING", "Dropped unrequested block " + std::to_string(begin) + " of piece "
+			+ std::to_string(piece_index) + " from peer " + std::to_string(n->peer_id()) + ".");
+		return true;
+	}
+	if (piece_data.size() != requested.length){
+		//a protocol violation, not something to hand to the disk
+		logger_->event("ERROR", "Peer " + std::to_string(n->peer_id()) + " sent " + std::to_string(piece_data.size())
+			+ " bytes for block " + std::to_string(begin) + " of piece " + std::to_string(piece_index) + ", "
+			+ std::to_string(requested.length) + " were requested. Disconnecting.");
+		if (!in_flight){
+			return false; //released when it was withdrawn
+		}
+		if (blocks){
+			assembler_->release(piece_index, begin);
+		} else {
+			picker_->release(piece_index, n->peer_id());
+		}
+		return false;
+	}
+	n->add_received(piece_data.size());
+
+	FrameBatch reply;
+	if (blocks){
+		//the piece only counts once every block is in, whoever sent them
+		BufferPool::Buffer assembled;
+		std::vector<uint32_t> contributors;
+		PieceAssembler::BlockResult r = has_piece(piece_index) ? PieceAssembler::BlockResult::Rejected
+			: assembler_->add_block(piece_index, begin, piece_data, n->peer_id(), assembled, contributors);
+		if (r == PieceAssembler::BlockResult::Rejected){
+			debug_message("Discarded block " + std::to_string(begin) + " of piece " + std::to_string(piece_index)
+				+ " from peer " + std::to_string(n->peer_id()));
+		} else if (r == PieceAssembler::BlockResult::Completed){
+			std::span<const char> whole = *assembled;
+			accept_piece(piece_index, whole, std::move(assembled), std::move(contributors));
+		}
+		if (r != PieceAssembler::BlockResult::Rejected && endgame_){
+			cancel_elsewhere(piece_index, begin, sock);
+		}
+	} else {
+		picker_->release(piece_index, n->peer_id());
+		if (endgame_){
+			cancel_elsewhere(piece_index, 0, sock);
+		}
 
-	if (has_piece(piece_index)){
-		debug_message("Received piece we already have: " + std::to_string(piece_index));
-		logger_->event("WARNING", "Received piece we already have: " + std::to_string(piece_index));
+		if (has_piece(piece_index) || is_pending(piece_index)){
+			debug_message("Received piece we already have: " + std::to_string(piece_index));
+			logger_->event("WARNING", "Received piece we already have: " + std::to_string(piece_index));
+		} else {
+			accept_piece(piece_index, piece_data, nullptr, {n->peer_id()});
+		}
+	}
 
-		return true;
+	//top the pipeline back up (one request at a time without the extension)
+	if (!has_complete_file() && !n->peer_choking()){
+		request_next_piece(sock, reply);
 	}
-	if (!write_piece_to_file(piece_index, piece_data)){
-		debug_message("Failed to write piece to file: " + std::to_string(piece_index));
-		logger_->event("ERROR", "Failed to write piece to file: " + std::to_string(piece_index));
 
+	if (!send_frames(n, reply)){
+		logger_->event("ERROR", "Failed to send REQUEST message to peer socket: " + std::to_string(sock));
 		return false;
 	}
-	set_bitfield_bit(piece_index, true);
 
-	//send HAVE message to all neighbors
-	uint32_t have_index_net = htonl(piece_index);
+	return true;
+}
+
+//a complete piece came in. it is hashed on the verify pool (with metainfo) and written on the disk
+//pool, the network thread moves on right away. owned may hold the bytes behind piece_data (otherwise
+//they are copied out of the receive buffer into a pooled buffer), contributors are the peers that sent it
+void P2P_Client::accept_piece(int piece_index, std::span<const char> piece_data, BufferPool::Buffer owned,
+	std::vector<uint32_t> contributors){
+	{
+		std::lock_guard<std::mutex> lck(pending_mu_);
+		if (!pending_.insert(piece_index).second){
+			return; //another copy is on its way to disk already
+		}
+	}
+	unstored_++;
+	BufferPool::Buffer data = std::move(owned);
+	if (!data){
+		data = buffers_->acquire(piece_data.size());
+		std::memcpy(data->data(), piece_data.data(), piece_data.size());
+	}
+
+	if (!ensure_metainfo()){
+		if (options_.verify_pieces){
+			logger_->event("WARNING", "Piece " + std::to_string(piece_index) + " from peer " + std::to_string(contributors.front())
+				+ " is stored unverified, there are no digests in " + meta_path_ + ".");
+		}
+		queue_write(piece_index, std::move(data), contributors.front());
+		return;
+	}
+	verify_pool_->submit([this, piece_index, data = std::move(data), contributors = std::move(contributors)]() mutable {
+		if (meta_->verify(piece_index, *data)){
+			queue_write(piece_index, std::move(data), contributors.front());
+		} else {
+			settle_piece(piece_index, false);
+			on_corrupt_piece(piece_index, contributors);
+		}
+	});
+}
+
+//hands a good piece to the disk pool, the bitfield and HAVEs follow once it is written
+void P2P_Client::queue_write(int piece_index, BufferPool::Buffer data, uint32_t from_peer){
+	disk_pool_->submit([this, piece_index, data = std::move(data), from_peer]{
+		if (cache_){
+			//a piece we just announced is the one neighbors ask for next, keep it in memory
+			cache_->insert(piece_index, data);
+		}
+		//the bit is set before the piece leaves pending_, so nobody asks for it in between
+		bool stored = store_piece(piece_index, *data, from_peer, -1);
+		if (stored){
+			store_failures_ = 0;
+		} else if (++store_failures_ == MAX_STORE_FAILURES){
+			pause_requests();
+		}
+		settle_piece(piece_index, stored);
+		if (!stored && !disk_backlogged()){
+			refill_all(); //ask for it again
+		}
+	});
+}
+
+//a piece left the verify/write pipeline (stored or thrown away). once the backlog drops below
+//DiskQueueDepth again the requests that were held back go out
+void P2P_Client::settle_piece(int piece_index, bool stored){
+	{
+		std::lock_guard<std::mutex> lck(pending_mu_);
+		pending_.erase(piece_index);
+		if (stored){
+			excluded_.erase(piece_index);
+		}
+	}
+	if (unstored_-- == options_.disk_queue_depth){
+		refill_all();
+	}
+}
+
+//backpressure: too many received pieces wait for the disk, or it kept failing our writes lately, hold
+//off new REQUESTs
+bool P2P_Client::disk_backlogged() const {
+	return unstored_ >= options_.disk_queue_depth || store_paused_until_ != 0;
+}
+
+//writes keep failing (disk full, I/O errors): rather than download the same pieces over and over, stop
+//requesting for STORE_RETRY_S and then try again
+void P2P_Client::pause_requests(){
+	auto until = std::chrono::steady_clock::now() + std::chrono::seconds(STORE_RETRY_S);
+	store_paused_until_ = until.time_since_epoch().count();
+	store_failures_ = 0;
+	logger_->event("ERROR", std::to_string(MAX_STORE_FAILURES) + " piece writes failed in a row, requests are paused for "
+		+ std::to_string(STORE_RETRY_S) + "s.");
+}
+
+//on the timer thread, lifts the pause once it is over
+void P2P_Client::resume_requests(){
+	int64_t until = store_paused_until_;
+	if (until == 0 || std::chrono::steady_clock::now().time_since_epoch().count() < until){
+		return;
+	}
+	if (store_paused_until_.compare_exchange_strong(until, 0)){
+		logger_->event("INFO", "Requesting pieces again after the write errors.");
+		refill_all();
+	}
+}
+
+void P2P_Client::refill_all(){
+	std::vector<int> socks;
+	{
+		std::lock_guard<std::mutex> lck(peers_mu_);
+		neighbors_->for_each([&](Neighbor* n){ socks.push_back(n->sock()); });
+	}
+	for (int sock : socks){
+		reactor_->post(sock, [this, sock]{ refill_requests(sock); });
+	}
+}
+
+//remembers who sent a bad copy so the piece is fetched from someone else, then has every neighbor
+//that has it top up its requests (on its own reactor thread)
+void P2P_Client::on_corrupt_piece(int piece_index, const std::vector<uint32_t>& contributors){
+	std::string from;
+	for (uint32_t id : contributors){
+		from += (from.empty() ? "" : ",") + std::to_string(id);
+	}
+	logger_->event("WARNING", "Piece " + std::to_string(piece_index) + " from peer " + from + " failed verification, requesting it again.");
+
+	std::vector<int> socks;
 	{
 		std::lock_guard<std::mutex> lck(peers_mu_);
-		for (auto* n : neighbors_){
-			if (!send_message(HAVE, &have_index_net, sizeof(have_index_net), n->sock())){
-				debug_message("Failed to send HAVE message to peer: " + std::to_string(n->peer_id()));
-				logger_->event("ERROR", "Failed to send HAVE message to peer: " + std::to_string(n->peer_id()));
+		std::lock_guard<std::mutex> vlck(pending_mu_);
+		std::set<uint32_t>& excluded = excluded_[piece_index];
+		excluded.insert(contributors.begin(), contributors.end());
+
+		bool other_source = false;
+		neighbors_->for_each([&](Neighbor* n){
+			if (n->has_piece(piece_index)){
+				socks.push_back(n->sock());
+				other_source = other_source || excluded.count(n->peer_id()) == 0;
 			}
+		});
+		if (!other_source){
+			excluded.clear(); //nobody else has it, give everyone another chance
 		}
 	}
+	for (int sock : socks){
+		reactor_->post(sock, [this, sock]{ refill_requests(sock); });
+	}
+}
+
+//runs on the socket's reactor thread: interest and requests may have to be renewed after a piece failed
+void P2P_Client::refill_requests(int sock){
+	Neighbor* n = find_neighbor_by_sock(sock);
+	if (n == nullptr){
+		return;
+	}
+	FrameBatch out;
+	bool wanted = next_wanted(n, 0) >= 0;
+	if (wanted && !n->am_interested()){
+		out.add(INTERESTED, nullptr, 0);
+		n->set_am_interested(true);
+	}
+	if (!n->peer_choking()){
+		request_next_piece(sock, out);
+	}
+	send_frames(n, out);
+}
+
+bool P2P_Client::is_pending(int piece_index) const {
+	std::lock_guard<std::mutex> lck(pending_mu_);
+	return pending_.count(piece_index) != 0;
+}
 
-	int pieces_have = 0;
-	for (size_t i = 0; i < total_pieces_; ++i){
-		if (has_piece(i)){
-			pieces_have++;
+//something this neighbor can give us: missing, not being verified, and it didn't send us a bad copy
+bool P2P_Client::wants_piece(Neighbor* n, int piece_index) const {
+	if (!n->has_piece(piece_index)){
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> lck(pending_mu_);
+		if (pending_.count(piece_index) != 0){
+			return false;
+		}
+		auto ex = excluded_.find(piece_index);
+		if (ex != excluded_.end() && ex->second.count(n->peer_id()) != 0){
+			return false;
 		}
 	}
-	Neighbor* neighbor = find_neighbor_by_sock(sock);
-	if (neighbor) {
-		logger_->line("Peer " + std::to_string(my_peer_id_) 
-			+ " has downloaded piece " + std::to_string(piece_index) 
-			+ " from peer " + std::to_string(neighbor->peer_id())
-			+ ". Now has " + std::to_string(pieces_have) 
-			+ " pieces.");
+	//only after pending_: a good piece gets its bit before it leaves the set
+	return !has_piece(piece_index);
+}
+
+//first piece >= from that wants_piece() agrees to, -1 if none. only pieces they have and we lack are
+//looked at, found a word (or with AVX2 four words) at a time
+int P2P_Client::next_wanted(Neighbor* n, int from) const {
+	for (long i = Bitfield::first_and_not(n->pieces(), bitfield_, from); i >= 0;
+		i = Bitfield::first_and_not(n->pieces(), bitfield_, i + 1)){
+		if (wants_piece(n, static_cast<int>(i))){
+			return static_cast<int>(i);
+		}
 	}
+	return -1;
+}
+
+//loads the seed's digests. leechers may start before the seed has written them, so a missing
+//file is retried (at most once a second) until it shows up
+bool P2P_Client::ensure_metainfo(){
+	if (meta_ready_){
+		return true;
+	}
+	if (!options_.verify_pieces){
+		return false;
+	}
+	std::lock_guard<std::mutex> lck(meta_mu_);
+	auto now = std::chrono::steady_clock::now();
+	if (!meta_ready_ && now - meta_last_try_ >= std::chrono::seconds(1)){
+		meta_last_try_ = now;
+		if (meta_->load(meta_path_)){
+			meta_ready_ = true;
+			logger_->event("INFO", "Loaded piece digests from " + meta_path_ + ", pieces are verified from now on.");
+		}
+	}
+	return meta_ready_;
+}
 
+//seeds (re)generate the digests when they are missing or older than the file
+void P2P_Client::prepare_metainfo(){
+	if (!options_.verify_pieces){
+		return;
+	}
+	if (!has_file_){
+		meta_ready_ = meta_->load(meta_path_);
+		meta_last_try_ = std::chrono::steady_clock::now();
+		if (!meta_ready_){
+			logger_->event("WARNING", "No piece digests in " + meta_path_ + " yet, pieces are not verified until the seed writes them.");
+		}
+		return;
+	}
+
+	struct stat data_st{};
+	struct stat meta_st{};
+	bool fresh = fstat(store_->fd(), &data_st) == 0 && stat(meta_path_.c_str(), &meta_st) == 0
+		&& (meta_st.st_mtim.tv_sec > data_st.st_mtim.tv_sec
+			|| (meta_st.st_mtim.tv_sec == data_st.st_mtim.tv_sec && meta_st.st_mtim.tv_nsec >= data_st.st_mtim.tv_nsec));
+	if (fresh && meta_->load(meta_path_)){
+		meta_ready_ = true;
+		return;
+	}
+
+	debug_message("Hashing " + std::to_string(total_pieces_) + " pieces into " + meta_path_
+		+ (sha256::accelerated() ? " (SHA extensions)" : ""));
+	meta_ready_ = meta_->generate(store_->fd(), meta_path_, *verify_pool_);
+	if (!meta_ready_){
+		logger_->event("ERROR", "Failed to write piece digests to " + meta_path_ + ".");
+	}
+}
+
+//writes a piece that is known to be good (on a disk pool thread), marks it and announces it to
+//every neighbor but skip_sock
+bool P2P_Client::store_piece(int piece_index, std::span<const char> piece_data, uint32_t from_peer, int skip_sock){
+	if (!write_piece_to_file(piece_index, piece_data)){
+		debug_message("Failed to write piece to file: " + std::to_string(piece_index));
+		logger_->event("ERROR", "Failed to write piece to file: " + std::to_string(piece_index));
+
+		return false;
+	}
+	set_bitfield_bit(piece_index, true);
+	picker_->on_complete(piece_index);
 	if (has_complete_file()){
-		debug_message("Peer " + std::to_string(my_peer_id_) + " has downloaded the complete file.");
-		logger_->event("INFO", "Peer " + std::to_string(my_peer_id_) + " has downloaded the complete file.");
+		//two disk threads can both store one of the last pieces and see the file complete
+		if (!completed_.exchange(true)){
+			store_->on_complete();
+			debug_message("Peer " + std::to_string(my_peer_id_) + " has downloaded the complete file.");
+			logger_->event("INFO", "Peer " + std::to_string(my_peer_id_) + " has downloaded the complete file.");
+		}
 	} else {
 		debug_message("Peer " + std::to_string(my_peer_id_) + " has not yet downloaded the complete file.");
 		logger_->event("INFO", "Peer " + std::to_string(my_peer_id_) + " has not yet downloaded the complete file.");
-
-		Neighbor* n = find_neighbor_by_sock(sock);
-		if (n && !n->choked()){
-			
-			{
-            std::lock_guard<std::mutex> lock(peers_mu_);
-            requested_pieces_.erase(piece_index);
-            piece_to_peer_.erase(piece_index);
-        	}
-			request_next_piece(sock);
-		}
 	}
 
+	//send HAVE message to all neighbors
+	uint32_t have_index_net = htonl(piece_index);
+	broadcast_message(HAVE, &have_index_net, sizeof(have_index_net), skip_sock);
+
+	size_t pieces_have = bitfield_.count();
+	logger_->line("Peer " + std::to_string(my_peer_id_) 
+		+ " has downloaded piece " + std::to_string(piece_index) 
+		+ " from peer " + std::to_string(from_peer)
+		+ ". Now has " + std::to_string(pieces_have) 
+		+ " pieces.");
 	return true;
 }
 
-bool P2P_Client::read_bitfield(int sock, std::vector<char> buf){
-	//updates the hasFile of the neighbor
-	set_hasFile_from_bf(sock, buf);
-	
+bool P2P_Client::read_bitfield(int sock, std::span<const char> buf){
 	Neighbor* n = find_neighbor_by_sock(sock);
 	if (n == nullptr){
 		return false;
 	}
 
-	n->init_bitfield(total_pieces_);
-
-	for (size_t i = 0; i < buf.size() && i < n->get_bitfield().size(); i++) {
-        n->get_bitfield()[i] = static_cast<uint8_t>(buf[i]);
-    }
+	//HAVEs may have come first, their counts are replaced along with the bits
+	picker_->remove_peer(n->pieces());
+	n->load_bitfield(total_pieces_, buf);
+	picker_->add_peer(n->pieces());
+	//updates the hasFile of the neighbor
+	set_hasFile_from_bf(sock, buf);
 
-	bool have_interesting_pieces = false;
-    for (int i = 0; i < total_pieces_; i++) {
-        if (!has_piece(i) && n->has_piece(i)) {
-            have_interesting_pieces = true;
-            break;
-        }
-    }
+	bool have_interesting_pieces = Bitfield::first_and_not(n->pieces(), bitfield_) >= 0;
 
 	if (have_interesting_pieces) {
-        send_message(INTERESTED, nullptr, 0, sock);
-        n->set_interested(true);
+        send_message(INTERESTED, nullptr, 0, n);
+        n->set_am_interested(true);
     } else {
-        send_message(UNINTERESTED, nullptr, 0, sock);
-        n->set_interested(false);
+        send_message(UNINTERESTED, nullptr, 0, n);
+        n->set_am_interested(false);
     }
 
+	if (super_seeding_){
+		super_seeder_->add_peer(n->pieces());
+		reveal_next(n);
+		if (super_seeder_->complete()){
+			end_super_seeding();
+		}
+	}
+	//a second BITFIELD (a super-seed showing all of its pieces) may come after they unchoked us
+	if (have_interesting_pieces && !n->peer_choking()){
+		FrameBatch out;
+		request_next_piece(sock, out);
+		return send_frames(n, out);
+	}
 	return true;
 }
 
 //sets whether or not the neighbor has the entire file (by looking if its bitmap is full of 1s)
-bool P2P_Client::set_hasFile_from_bf(int sock, std::vector<char> buf){
-	const size_t num_pieces = static_cast<size_t>(total_pieces_);
-
-	if (buf.empty() || num_pieces == 0){
+bool P2P_Client::set_hasFile_from_bf(int sock, std::span<const char> buf){
+	Neighbor* n = find_neighbor_by_sock(sock);
+	if (n == nullptr){
+		return false;
+	}
+	if (buf.empty() || total_pieces_ == 0){
 		return true;
 	}
+	n->set_has_file(n->pieces().all());
+	return true;
+}
 
-	bool entire_file = true;
-
-	for (size_t i = 0; i < num_pieces; ++i){
-		size_t byte = i/8;
-		size_t bit = 7- (i % 8);
+bool P2P_Client::read_piece_from_file(int piece_index, std::vector<char>& piece_data){
+	return store_->read_piece(piece_index, piece_data);
+}
 
-		if (byte >= buf.size()){
-			entire_file = false;
-			break;
-		}
+bool P2P_Client::write_piece_to_file(int piece_index, std::span<const char> piece_data){
+	return store_->write_piece(piece_index, piece_data);
+}
 
-		unsigned char b = static_cast<unsigned char>(buf[byte]);
-		bool bit_set = ((b >> bit) & 1) != 0;
-		if (!bit_set){
-			entire_file = false;
-			break;
-		}
-	}
+//pieces left over from an earlier run (the file already reached that far when it was opened)
+bool P2P_Client::has_piece_on_disk(int piece_index) const {
+	return store_->on_disk(piece_index);
+}
 
-	std::lock_guard<std::mutex> lck(peers_mu_);
-	Neighbor* n = find_neighbor_by_sock(sock);
-	if (n != nullptr){
-		n->set_has_file(true);
+//a leftover piece only counts if it matches its digest (when we have the digests)
+bool P2P_Client::verify_on_disk(int piece_index){
+	if (!meta_ready_){
 		return true;
-		}
-	return false;
+	}
+	std::vector<char> data;
+	return read_piece_from_file(piece_index, data) && meta_->verify(piece_index, data);
 }
 
-//reads bitfield from disk into memory
-bool P2P_Client::read_piece_from_file(int piece_index, std::vector<char>& piece_data){
-	std::lock_guard<std::mutex> lck(file_mu_);
-
-	size_t offset = static_cast<size_t>(piece_index) * piece_size_;
-
-	size_t this_piece_size = piece_size_;
+size_t P2P_Client::piece_length(int piece_index) const {
 	if (piece_index == total_pieces_ - 1){
-		this_piece_size = file_size_ - (piece_index * piece_size_);
+		return file_size_ - (static_cast<size_t>(piece_index) * piece_size_);
 	}
+	return piece_size_;
+}
 
-	std::string file_path = "peer_" + std::to_string(my_peer_id_) + "/" + file_name_;
-    std::ifstream file(file_path, std::ios::binary);
-
-	if (!file){
-		return false;
+void P2P_Client::set_bitfield_bit(int piece_index, bool value){
+	if (piece_index < 0){
+		return;
 	}
-
-	file.seekg(offset, std::ios::beg);
-	if (!file){
-		return false;
+	if (value){
+		bitfield_.set(piece_index);
+	} else {
+		bitfield_.reset(piece_index);
 	}
-	piece_data.resize(this_piece_size);
-	file.read(piece_data.data(), this_piece_size);
-	if (!file){
+}
+
+bool P2P_Client::has_piece(int piece_index) const {
+	return piece_index >= 0 && bitfield_.test(piece_index);
+}
+
+bool P2P_Client::has_complete_file() const{
+	return bitfield_.all();
+}
+
+bool P2P_Client::watch_connection(int sock){
+	if (!reactor_->add(sock)){
+		logger_->event("ERROR", "Failed to register peer socket " + std::to_string(sock) + " with the event loop.");
 		return false;
 	}
+	reactor_->set_writable(sock, true); //flushes whatever was queued before the socket was watched
 	return true;
 }
 
-	
-bool P2P_Client::write_piece_to_file(int piece_index, std::vector<char>& piece_data){
-	std::lock_guard<std::mutex> lck(file_mu_);
-
-	size_t offset = static_cast<size_t>(piece_index) * piece_size_;
-	size_t this_piece_size = piece_size_;
-	if (piece_index == total_pieces_ - 1){
-		this_piece_size = file_size_ - (piece_index * piece_size_);
+//runs on the reactor thread that owned the socket, after it has stopped watching it
+void P2P_Client::on_connection_closed(int sock){
+	debug_message("Failed to read message from peer socket: " + std::to_string(sock));
+	logger_->event("ERROR", "Failed to read message from peer socket: " + std::to_string(sock));
+
+	//before peers_mu_, the picker's lock comes first. anything we were waiting on from this peer
+	//has to be asked for again
+	if (Neighbor* gone = neighbors_->by_sock(sock)){
+		picker_->remove_peer(gone->pieces());
+		release_requests(gone);
+		if (super_seeder_){
+			super_seeder_->remove_peer(gone->peer_id());
+		}
 	}
 
-	if (piece_data.size() != this_piece_size){
-		return false;
+	std::lock_guard<std::mutex> lck(peers_mu_);
+	Neighbor* n = neighbors_->by_sock(sock);
+	if (n == nullptr){
+		return;
 	}
+	logger_->event("DISCONNECT", "Lost connection to peer " + std::to_string(n->peer_id()));
+	neighbors_->remove(sock); //closes the socket
+}
 
-	std::string file_path = "peer_" + std::to_string(my_peer_id_) + "/" + file_name_;
-    std::fstream file(file_path, std::ios::binary | std::ios::in | std::ios::out);
-	
-	//if file does not exist create it
-	if (!file){
-		file.open(file_path, std::ios::binary | std::ios::out);
-		if (!file){
-			return false;
+//gives back the blocks or pieces reserved for this neighbor and forgets its outstanding requests
+void P2P_Client::release_requests(Neighbor* n){
+	if (n->supports(EXT_BLOCKS)){
+		for (const auto& r : n->requests()){
+			assembler_->release(r.piece, r.begin);
 		}
-		file.close();
+	} else {
+		picker_->release_peer(n->peer_id());
+	}
+	n->clear_requests();
+}
 
-		//reopen in read/write mode
-		file.open(file_path,  std::ios::binary | std::ios::in | std::ios::out);
-		if (!file){
-			return false;
+//runs on the socket's reactor thread: requests past their deadline are released so someone else
+//(or this neighbor, once the new ones are out) can be asked, then the window is topped up
+void P2P_Client::expire_requests(int sock){
+	Neighbor* n = find_neighbor_by_sock(sock);
+	if (n == nullptr){
+		return;
+	}
+	std::vector<PendingRequest> expired = n->take_expired(std::chrono::steady_clock::now());
+	if (expired.empty()){
+		return;
+	}
+	FrameBatch out;
+	for (const auto& r : expired){
+		if (n->supports(EXT_BLOCKS)){
+			assembler_->release(r.piece, r.begin);
+		} else {
+			picker_->release(r.piece, n->peer_id());
+		}
+		//so a slow neighbor doesn't spend its upload on a copy someone else is sending now
+		if (n->supports(EXT_CANCEL)){
+			add_cancel(n, out, r.piece, r.begin, r.length);
 		}
 	}
-
-	file.seekp(offset, std::ios::beg);
-	if (!file){
-		return false;
+	logger_->event("WARNING", std::to_string(expired.size()) + " request(s) to peer " + std::to_string(n->peer_id())
+		+ " timed out, asking again.");
+	if (!out.empty()){
+		send_frames(n, out);
 	}
+	refill_all(); //the released pieces may be wanted from any neighbor
+}
 
-	file.write(piece_data.data(), this_piece_size);
-	file.flush();
-
-	if (!file){
-		return false;
+void P2P_Client::expire_all(){
+	std::vector<int> socks;
+	{
+		std::lock_guard<std::mutex> lck(peers_mu_);
+		for (size_t s = 0; s < neighbors_->end_slot(); ++s){
+			if (neighbors_->at(s) != nullptr && neighbors_->in_flight(s) > 0){
+				socks.push_back(neighbors_->at(s)->sock());
+			}
+		}
+	}
+	for (int sock : socks){
+		reactor_->post(sock, [this, sock]{ expire_requests(sock); });
 	}
-	return true;
 }
 
-bool P2P_Client::has_piece_on_disk(int piece_index) const {
-	debug_message("has piece on disk(" + std::to_string(piece_index) + ") called");
-	std::string piece_file = Config::peerDirName(my_peer_id_) + "/" + file_name_;
-	debug_message("Checking file: " + piece_file);
+//picks the next block to ask this neighbor for: first a missing block of a piece already
+//being assembled (so pieces finish instead of all starting), then the first block of a new piece
+bool P2P_Client::reserve_next_block(Neighbor* n, int& piece_index, uint32_t& begin, uint32_t& length){
+	auto wanted = [this, n](int i){ return wants_piece(n, i); };
+	if (assembler_->reserve_block(wanted, piece_index, begin, length)){
+		return true;
+	}
 
-	std::lock_guard<std::mutex> lck(file_mu_);
+	int i = pick_piece(n);
+	if (i >= 0 && assembler_->start_piece(i, begin, length)){
+		piece_index = i;
+		return true;
+	}
+	if (!in_endgame()){
+		return false;
+	}
 
-	size_t offset = static_cast<size_t>(piece_index) * piece_size_;
-	size_t this_piece_size = piece_size_;
-	if (piece_index == total_pieces_ - 1){
-		this_piece_size = file_size_ - (piece_index * piece_size_);
+	//endgame: blocks another neighbor is already fetching, then pieces reserved whole elsewhere
+	auto not_asked = [n](int p, uint32_t b){ return !n->is_requested(p, b); };
+	if (assembler_->duplicate_block(wanted, not_asked, piece_index, begin, length)){
+		return true;
+	}
+	i = pick_endgame(n);
+	if (i >= 0 && assembler_->start_piece(i, begin, length)){
+		piece_index = i;
+		return true;
 	}
+	return false;
+}
 
-	std::string file_path = "peer_" + std::to_string(my_peer_id_) + "/" + file_name_;
-	std::ifstream file(file_path, std::ios::binary);
+//the piece the picker chooses among those this neighbor can give us that nobody is fetching yet
+//(not in flight from it, not being assembled, not reserved by anyone), -1 if none. without
+//EXT_BLOCKS the piece is reserved for this neighbor
+int P2P_Client::pick_piece(Neighbor* n){
+	auto accept = [this, n](int i){
+		return wants_piece(n, i) && !n->is_requested(i) && !assembler_->in_progress(i);
+	};
+	if (n->supports(EXT_BLOCKS)){
+		return picker_->pick(n->pieces(), accept);
+	}
+	return picker_->pick_and_reserve(n->pieces(), n->peer_id(), accept);
+}
 
-	if (!file){
+//endgame starts once every missing piece could be in flight already: nothing is left to pick and
+//fewer pieces are missing than we have requests out. from then on idle neighbors duplicate requests
+bool P2P_Client::in_endgame(){
+	if (endgame_){
+		return true;
+	}
+	if (!options_.endgame){
 		return false;
 	}
-
-	file.seekg(0, std::ios::end);
-	size_t file_size = static_cast<size_t>(file.tellg());
-
-	if (file_size < offset + this_piece_size){
+	size_t missing = static_cast<size_t>(total_pieces_) - bitfield_.count();
+	size_t requested = 0;
+	{
+		std::lock_guard<std::mutex> lck(peers_mu_);
+		requested = neighbors_->total_in_flight();
+	}
+	if (missing == 0 || missing > requested){
 		return false;
 	}
-	
+	if (!endgame_.exchange(true)){
+		logger_->event("INFO", "Peer " + std::to_string(my_peer_id_) + " entered endgame with " + std::to_string(missing)
+			+ " pieces missing and " + std::to_string(requested) + " requests in flight.");
+	}
 	return true;
 }
 
-void P2P_Client::set_bitfield_bit(int piece_index, bool value){
-	size_t byte = piece_index / 8;
-	size_t bit = 7 - (piece_index % 8);
+//a piece this neighbor has that is in flight from someone else (not from it, and not being assembled
+//in blocks when it only takes whole requests), -1 if none
+int P2P_Client::pick_endgame(Neighbor* n){
+	for (int i = next_wanted(n, 0); i >= 0; i = next_wanted(n, i + 1)){
+		if (!n->is_requested(i) && (n->supports(EXT_BLOCKS) || !assembler_->in_progress(i))){
+			return i;
+		}
+	}
+	return -1;
+}
+
+//the first copy of a piece (or block) arrived, withdraw the requests other neighbors still have for it.
+//neighbors without EXT_CANCEL would drop the connection on a CANCEL, their copy is left to arrive and
+//thrown away as a duplicate
+void P2P_Client::cancel_elsewhere(int piece_index, uint32_t begin, int except_sock){
+	std::vector<int> socks;
+	{
+		std::lock_guard<std::mutex> lck(peers_mu_);
+		for (size_t s = 0; s < neighbors_->end_slot(); ++s){
+			Neighbor* other = neighbors_->at(s);
+			if (other != nullptr && neighbors_->in_flight(s) > 0 && other->sock() != except_sock && other->supports(EXT_CANCEL)){
+				socks.push_back(other->sock());
+			}
+		}
+	}
+	for (int sock : socks){
+		reactor_->post(sock, [this, sock, piece_index, begin]{ cancel_request(sock, piece_index, begin); });
+	}
+}
 
-	if (byte >= bitfield_.size()){
+//runs on the socket's reactor thread, sends CANCEL if this neighbor still owes us the block
+void P2P_Client::cancel_request(int sock, int piece_index, uint32_t begin){
+	Neighbor* n = find_neighbor_by_sock(sock);
+	PendingRequest r{};
+	if (n == nullptr || !n->cancel_request(piece_index, begin, r)){
 		return;
 	}
+	if (!n->supports(EXT_BLOCKS)){
+		picker_->release(piece_index, n->peer_id());
+	}
+	FrameBatch out;
+	add_cancel(n, out, piece_index, begin, r.length);
+	//the slot it frees can go to another piece
+	if (!n->peer_choking() && !has_complete_file()){
+		request_next_piece(sock, out);
+	}
+	send_frames(n, out);
+}
 
-	if (value){
-		bitfield_[byte] |= (1 << bit);
+//queues a CANCEL with the same payload as the REQUEST it withdraws
+void P2P_Client::add_cancel(Neighbor* n, FrameBatch& out, int piece_index, uint32_t begin, uint32_t length){
+	if (n->supports(EXT_BLOCKS)){
+		uint32_t cancel[3] = {htonl(static_cast<uint32_t>(piece_index)), htonl(begin), htonl(length)};
+		out.add(CANCEL, cancel, sizeof(cancel));
 	} else {
-		bitfield_[byte] &= ~(1 << bit);
+		uint32_t piece_net = htonl(static_cast<uint32_t>(piece_index));
+		out.add(CANCEL, &piece_net, sizeof(piece_net));
 	}
 }
 
-bool P2P_Client::has_piece(int piece_index) const {
-	size_t byte = piece_index / 8;
-	size_t bit = 7 - (piece_index % 8);
-
-	if (byte >= bitfield_.size()){
-		return false;
+//queues our next REQUESTs (or NOT INTERESTED) for this neighbor into out, the caller flushes it
+//keeps up to request_window() requests outstanding, which is one unless pipelining was negotiated
+//neighbors with EXT_BLOCKS are asked for blocks, and always get at least a piece worth of them
+void P2P_Client::request_next_piece(int sock, FrameBatch& out){
+	Neighbor* n = find_neighbor_by_sock(sock);
+	if (n == nullptr){
+		return;
+	}
+	if (disk_backlogged()){
+		return; //settle_piece asks again once the disk catches up
 	}
 
-	unsigned char b = static_cast<unsigned char>(bitfield_[byte]);
-	return ((b >> bit) & 1) != 0;
-}
+	if (n->supports(EXT_BLOCKS)){
+		size_t block = assembler_->block_size();
+		size_t per_piece = (piece_size_ + block - 1) / block;
+		size_t window = std::max(n->request_window(EXT_PIPELINING, options_.max_outstanding_requests, block),
+			std::min<size_t>(per_piece, options_.max_outstanding_requests));
+		while (n->in_flight() < window){
+			int piece_index = -1;
+			uint32_t begin = 0;
+			uint32_t length = 0;
+			if (!reserve_next_block(n, piece_index, begin, length)){
+				break;
+			}
+			n->on_request_sent(piece_index, begin, length);
 
-bool P2P_Client::has_complete_file() const{
-	for (size_t i = 0; i < total_pieces_; ++i){
-		if (!has_piece(i)){
-			return false;
+			uint32_t request[3] = {htonl(static_cast<uint32_t>(piece_index)), htonl(begin), htonl(length)};
+			out.add(REQUEST, request, sizeof(request));
+		}
+
+		//blocks reserved for other neighbors may still come back, so only give up when nothing is left
+		if (n->in_flight() == 0 && n->am_interested()){
+			if (next_wanted(n, 0) < 0){
+				out.add(UNINTERESTED, nullptr, 0);
+				n->set_am_interested(false);
+			}
 		}
+		return;
 	}
-	return true;
-}
 
-void P2P_Client::peer_message_loop(int sock){
-	while (true){
-		if (!read_message(sock)){
-			debug_message("Failed to read message from peer socket: " + std::to_string(sock));
-			logger_->event("ERROR", "Failed to read message from peer socket: " + std::to_string(sock));
-			{
-				std::lock_guard<std::mutex> lck(peers_mu_);
-				auto it = sock_to_peer_.find(sock);
-				if (it != sock_to_peer_.end()){
-					logger_->event("DISCONNECT", "Lost connection to peer " + std::to_string(it->second));
-					sock_to_peer_.erase(it);
-
-				}
+	size_t window = n->request_window(EXT_PIPELINING, options_.max_outstanding_requests, piece_size_);
+	while (n->in_flight() < window){
+		int piece_to_request = pick_piece(n);
+		if (piece_to_request == -1 && in_endgame()){
+			piece_to_request = pick_endgame(n);
+		}
+
+		if (piece_to_request == -1){
+			if (n->in_flight() == 0 && n->am_interested()){
+				out.add(UNINTERESTED, nullptr, 0);
+				n->set_am_interested(false);
 			}
-			break;
+			return;
 		}
+
+		n->on_request_sent(piece_to_request, 0, static_cast<uint32_t>(piece_length(piece_to_request)));
+
+		uint32_t piece_net = htonl(static_cast<uint32_t>(piece_to_request));
+		out.add(REQUEST, &piece_net, sizeof(piece_net));
 	}
 }
 
-void P2P_Client::start_peer_message_loop(int sock){
-	peer_threads_.push_back(std::thread(&P2P_Client::peer_message_loop, this, sock));
+//every periodic job of the peer is a timer on one wheel: request deadlines every REQUEST_CHECK_MS,
+//rate samples every RATE_SAMPLE_MS, the preferred neighbors every unchoking interval and the
+//optimistic unchoke every optimistic unchoking interval
+void P2P_Client::start_timers(){
+	timers_ = new TimerWheel();
+	timers_->every(std::chrono::milliseconds(REQUEST_CHECK_MS), [this]{
+		expire_all();
+		resume_requests();
+	});
+	timers_->every(std::chrono::milliseconds(RATE_SAMPLE_MS), [this]{ sample_rates(); });
+	timers_->every(std::chrono::seconds(unchoking_interval_), [this]{
+		select_preferred_neighbors();
+		log_memory_stats(false);
+	});
+	timers_->every(std::chrono::seconds(options_.optimistic_unchoking_interval), [this]{ select_optimistic_neighbor(); });
+	if (super_seeder_){
+		timers_->every(std::chrono::seconds(unchoking_interval_), [this]{ reveal_stalled(); });
+	}
 }
 
-void P2P_Client::request_next_piece(int sock){
-	Neighbor* n = find_neighbor_by_sock(sock);
-	if (n == nullptr){
+//the bytes counted since the last sample become rates, smoothed over about one unchoking interval
+void P2P_Client::sample_rates(){
+	std::lock_guard<std::mutex> lock(peers_mu_);
+	auto now = std::chrono::steady_clock::now();
+	neighbors_->sample_rates(std::chrono::duration<double>(now - last_sample_).count(), unchoking_interval_);
+	last_sample_ = now;
+}
+
+//a neighbor from PeerInfo.cfg that wasn't up yet is tried again after backoff seconds, the attempt
+//itself runs on connect_pool_ since connect() may block
+void P2P_Client::schedule_reconnect(const InitNeighborInfo& info, unsigned int backoff){
+	std::lock_guard<std::mutex> lock(peers_mu_);
+	if (!running_){
 		return;
 	}
+	reconnects_[info.peerId] = timers_->after(std::chrono::seconds(backoff), [this, info, backoff]{
+		connect_pool_->submit([this, info, backoff]{ reconnect(info, backoff); });
+	});
+}
 
-	int piece_to_request = -1;
-	for (int i = 0; i < total_pieces_; ++i){
-		if (!has_piece(i) && n->has_piece(i)){
-			piece_to_request = i;
-			break;
+void P2P_Client::reconnect(const InitNeighborInfo& info, unsigned int backoff){
+	{
+		std::lock_guard<std::mutex> lock(peers_mu_);
+		reconnects_.erase(info.peerId);
+		if (!running_ || neighbors_->by_id(info.peerId) != nullptr){
+			return; //shutting down, or they connected to us in the meantime
 		}
 	}
+	if (connect_and_handshake(info.host, info.port, info.peerId, info.hasFile)){
+		return;
+	}
+	backoff = std::min(2 * backoff, RECONNECT_MAX_S);
+	logger_->event("WARNING", "Peer " + std::to_string(info.peerId) + " is still unreachable, next try in "
+		+ std::to_string(backoff) + "s.");
+	schedule_reconnect(info, backoff);
+}
 
-	if (piece_to_request == -1){
-		if (n->interested()) {
-            send_message(UNINTERESTED, nullptr, 0, sock);
-        }
-
+//runs on the neighbor's reactor thread: shows it the next piece with a HAVE, unless it is still
+//downloading the last one
+void P2P_Client::reveal_next(Neighbor* n){
+	if (!super_seeding_){
 		return;
 	}
+	int current = super_seeder_->revealed(n->peer_id());
+	if (current >= 0 && !n->has_piece(current)){
+		return;
+	}
+	int piece_index = super_seeder_->reveal(n->peer_id(), n->pieces());
+	if (piece_index < 0){
+		return;
+	}
+	uint32_t piece_net = htonl(static_cast<uint32_t>(piece_index));
+	send_message(HAVE, &piece_net, sizeof(piece_net), n);
+}
+
+//runs on n's reactor thread after its HAVE: the neighbors that were shown this piece move on (on
+//their own threads). n moves on too if it was its piece and nobody is left to pass it to
+void P2P_Client::super_seed_have(Neighbor* n, int piece_index){
+	std::vector<uint32_t> next = super_seeder_->on_have(n->peer_id(), piece_index);
+	bool own = super_seeder_->revealed(n->peer_id()) == piece_index;
+	//outside peers_mu_, the picker's lock comes first
+	uint32_t holders = own ? picker_->availability(piece_index) : 0;
 
+	std::vector<int> socks;
 	{
-        std::lock_guard<std::mutex> lock(peers_mu_);
-        requested_pieces_.insert(piece_to_request);
-        piece_to_peer_[piece_to_request] = n->peer_id();
-    }
+		std::lock_guard<std::mutex> lck(peers_mu_);
+		if (own && holders >= neighbors_->size()){
+			next.push_back(n->peer_id());
+		}
+		for (uint32_t id : next){
+			if (Neighbor* other = neighbors_->by_id(id)){
+				socks.push_back(other->sock());
+			}
+		}
+	}
+	for (int sock : socks){
+		if (sock == n->sock()){
+			reveal_next(n);
+			continue;
+		}
+		reactor_->post(sock, [this, sock]{
+			if (Neighbor* other = find_neighbor_by_sock(sock)){
+				reveal_next(other);
+			}
+		});
+	}
+	if (super_seeder_->complete()){
+		end_super_seeding();
+	}
+}
 
-	uint32_t piece_net = htonl(static_cast<uint32_t>(piece_to_request));
-    send_message(REQUEST, &piece_net, sizeof(piece_net), sock);
+//a revealed piece can get stuck (whoever had it left before passing it on, or nobody wants it from
+//them), the neighbors that have theirs by now get the next one anyway
+void P2P_Client::reveal_stalled(){
+	if (!super_seeding_){
+		return;
+	}
+	std::vector<uint32_t> stalled = super_seeder_->stalled(std::chrono::steady_clock::now(), std::chrono::seconds(2 * unchoking_interval_));
+	std::vector<int> socks;
+	{
+		std::lock_guard<std::mutex> lck(peers_mu_);
+		for (uint32_t id : stalled){
+			if (Neighbor* n = neighbors_->by_id(id)){
+				socks.push_back(n->sock());
+			}
+		}
+	}
+	for (int sock : socks){
+		reactor_->post(sock, [this, sock]{
+			if (Neighbor* n = find_neighbor_by_sock(sock)){
+				reveal_next(n);
+			}
+		});
+	}
 }
 
-void P2P_Client::unchoke_timer_loop() {
-    while (running_) {
-        std::this_thread::sleep_for(std::chrono::seconds(unchoking_interval_));
-        select_preferred_neighbors();
-    }
+//every piece is out in the swarm, from now on we seed like anyone else: the full BITFIELD replaces
+//the empty one (neighbors recount our pieces and ask for what they still lack)
+void P2P_Client::end_super_seeding(){
+	if (!super_seeding_.exchange(false)){
+		return;
+	}
+	double copies = static_cast<double>(uploaded_) / file_size_;
+	logger_->line("Peer " + std::to_string(my_peer_id_) + " stopped super-seeding, the swarm holds every piece after "
+		+ std::to_string(uploaded_.load()) + " bytes uploaded (" + std::to_string(copies) + " copies of the file).");
+	std::vector<uint8_t> bits = bitfield_.to_bytes();
+	std::lock_guard<std::mutex> lck(peers_mu_);
+	neighbors_->for_each([&](Neighbor* n){
+		send_message(BITFIELD, bits.data(), static_cast<uint32_t>(bits.size()), n);
+	});
 }
 
-void P2P_Client::select_preferred_neighbors() {
+//cleared first, their REQUEST can reach the reactor before send_message returns
+void P2P_Client::unchoke_neighbor(Neighbor* n){
+	n->set_choked(false);
+	send_message(UNCHOKE, nullptr, 0, n);
+}
+
+void P2P_Client::choke_neighbor(Neighbor* n){
+	send_message(CHOKE, nullptr, 0, n);
+	n->set_choked(true);
+	//the CHOKE overtakes queued pieces and they drop their requests on it, unsent pieces would be wasted
+	n->outbox().discard_bulk();
+}
+
+//tit-for-tat: the interested neighbors that sent us the most during the last rounds are unchoked, so
+//our upload goes to peers that upload to us. ties are broken at random. a seed has nobody to
+//reciprocate and picks at random (or by how fast neighbors take its data, SeedChoking Upload)
+//
+//a neighbor that unchoked us but sent nothing for snub_timeout is snubbing us, it goes behind everyone
+//else so its slot goes to a neighbor that does upload. the optimistic neighbor keeps its unchoke
+void P2P_Client::select_preferred_neighbors(){
 	std::lock_guard<std::mutex> lock(peers_mu_);
 
-	std::vector<Neighbor*> interested_neighbors;
-	for (auto* n : neighbors_) {
-		if (n->interested()) {
-			interested_neighbors.push_back(n);
+	auto now = std::chrono::steady_clock::now();
+
+	//walks the interest and rate columns, the Neighbor objects are only touched for the ones picked
+	std::vector<size_t> candidates;
+	std::set<uint32_t> snubbed;
+	auto snub_timeout = std::chrono::seconds(options_.snub_timeout);
+	for (size_t s = 0; s < neighbors_->end_slot(); ++s){
+		if (neighbors_->at(s) == nullptr){
+			continue;
 		}
+		if (neighbors_->snubbed(s, now, snub_timeout)){
+			uint32_t id = neighbors_->peer_id(s);
+			snubbed.insert(id);
+			if (snubbed_.count(id) == 0){
+				logger_->line("Peer " + std::to_string(my_peer_id_) + " is snubbed by peer " + std::to_string(id) + ".");
+			}
+		}
+		if (neighbors_->interested(s)){
+			candidates.push_back(s);
+		}
+	}
+	snubbed_ = std::move(snubbed);
+
+	//shuffled first, so the stable sort leaves equal rates in random order
+	std::shuffle(candidates.begin(), candidates.end(), choke_rng_);
+	bool seeding = has_complete_file();
+	if (!seeding){
+		std::stable_sort(candidates.begin(), candidates.end(),
+			[this](size_t a, size_t b){ return neighbors_->down_rate(a) > neighbors_->down_rate(b); });
+	} else if (options_.seed_choking == SeedChoking::Upload){
+		std::stable_sort(candidates.begin(), candidates.end(),
+			[this](size_t a, size_t b){ return neighbors_->up_rate(a) > neighbors_->up_rate(b); });
 	}
+	std::stable_partition(candidates.begin(), candidates.end(),
+		[this](size_t s){ return snubbed_.count(neighbors_->peer_id(s)) == 0; });
 
 	std::set<uint32_t> current_preferred;
 
-	for (size_t i = 0; i < num_pref_neighbors_ && i < interested_neighbors.size(); ++i) {
-		current_preferred.insert(interested_neighbors[i]->peer_id());
+	for (size_t i = 0; i < num_pref_neighbors_ && i < candidates.size(); ++i){
+		Neighbor* n = neighbors_->at(candidates[i]);
+		current_preferred.insert(n->peer_id());
 
-		if (interested_neighbors[i]->choked()) {
-			send_message(UNCHOKE, nullptr, 0, interested_neighbors[i]->sock());
-			interested_neighbors[i]->set_choked(false);
+		if (n->choked()){
+			unchoke_neighbor(n);
 		}
 
 	}
 
-	for (auto* n : neighbors_) {
-		if (current_preferred.find(n->peer_id()) == current_preferred.end()) {
-			if (!n->choked()) {
-				send_message(CHOKE, nullptr, 0, n->sock());
-				n->set_choked(true);
-			}
+	for (size_t s = 0; s < neighbors_->end_slot(); ++s){
+		Neighbor* n = neighbors_->at(s);
+		if (n == nullptr || neighbors_->choked(s)){
+			continue;
+		}
+		uint32_t id = neighbors_->peer_id(s);
+		if (current_preferred.find(id) == current_preferred.end() && !(has_optimistic_ && id == optimistic_neighbor_)){
+			choke_neighbor(n);
 		}
 
 	}
 
 	preferred_neighbors_ = std::move(current_preferred);
 	std::string neighbor_list;
-	for (auto id : preferred_neighbors_) {
+	for (auto id : preferred_neighbors_){
 		if (!neighbor_list.empty()) neighbor_list += ",";
 		neighbor_list += std::to_string(id);
 	}
 	logger_->line("Peer " + std::to_string(my_peer_id_) + " has the preferred neighbors " + neighbor_list + ".");
 
+}
+
+//one choked, interested neighbor is unchoked whatever its rate, so a neighbor with nothing to give yet
+//still gets its first pieces, and we get to find out if it uploads faster than our preferred ones.
+//neighbors that connected during the last three rotations are three times as likely to be picked
+void P2P_Client::select_optimistic_neighbor(){
+	std::lock_guard<std::mutex> lock(peers_mu_);
+
+	auto now = std::chrono::steady_clock::now();
+	auto recent = std::chrono::seconds(3 * options_.optimistic_unchoking_interval);
+	std::vector<size_t> candidates;
+	std::vector<double> weights;
+	for (size_t s = 0; s < neighbors_->end_slot(); ++s){
+		if (neighbors_->at(s) == nullptr || !neighbors_->interested(s) || !neighbors_->choked(s)){
+			continue;
+		}
+		if (has_optimistic_ && neighbors_->peer_id(s) == optimistic_neighbor_){
+			continue;
+		}
+		candidates.push_back(s);
+		weights.push_back(now - neighbors_->connected_at(s) < recent ? 3.0 : 1.0);
+	}
+	if (candidates.empty()){
+		return; //nobody else is waiting, the current one (if any) keeps the slot
+	}
+
+	std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+	Neighbor* chosen = neighbors_->at(candidates[pick(choke_rng_)]);
+
+	if (has_optimistic_ && preferred_neighbors_.count(optimistic_neighbor_) == 0){
+		Neighbor* old = neighbors_->by_id(optimistic_neighbor_);
+		if (old != nullptr && !old->choked()){
+			choke_neighbor(old);
+		}
+	}
+
+	optimistic_neighbor_ = chosen->peer_id();
+	has_optimistic_ = true;
+	unchoke_neighbor(chosen);
+	logger_->line("Peer " + std::to_string(my_peer_id_) + " has the optimistically unchoked neighbor " + std::to_string(optimistic_neighbor_) + ".");
 }
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include "PieceAssembler.hpp"
+#include <algorithm>
+#include <cstring>
+
+PieceAssembler::PieceAssembler(int total_pieces, size_t piece_size, size_t file_size, size_t block_size, BufferPool* pool)
+	: total_pieces_(total_pieces),
+	piece_size_(piece_size),
+	file_size_(file_size),
+	block_size_(block_size > 0 ? block_size : piece_size),
+	pool_(pool){}
+
+size_t PieceAssembler::piece_length(int piece_index) const {
+	if (piece_index == total_pieces_ - 1){
+		return file_size_ - static_cast<size_t>(piece_index) * piece_size_;
+	}
+	return piece_size_;
+}
+
+bool PieceAssembler::reserve_in(Partial& p, int piece_index, uint32_t& begin, uint32_t& length){
+	for (size_t b = 0; b < p.blocks.size(); ++b){
+		if (p.blocks[b] != MISSING){
+			continue;
+		}
+		p.blocks[b] = REQUESTED;
+		size_t offset = b * block_size_;
+		size_t len = piece_length(piece_index) - offset;
+		begin = static_cast<uint32_t>(offset);
+		length = static_cast<uint32_t>(len < block_size_ ? len : block_size_);
+		return true;
+	}
+	return false;
+}
+
+bool PieceAssembler::reserve_block(const std::function<bool(int)>& accept, int& piece_index, uint32_t& begin, uint32_t& length){
+	std::lock_guard<std::mutex> lck(mu_);
+	for (auto& [index, p] : partials_){
+		if (!accept(index)){
+			continue;
+		}
+		if (reserve_in(p, index, begin, length)){
+			piece_index = index;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool PieceAssembler::duplicate_block(const std::function<bool(int)>& accept, const std::function<bool(int, uint32_t)>& accept_block,
+	int& piece_index, uint32_t& begin, uint32_t& length){
+	std::lock_guard<std::mutex> lck(mu_);
+	for (auto& [index, p] : partials_){
+		if (!accept(index)){
+			continue;
+		}
+		for (size_t b = 0; b < p.blocks.size(); ++b){
+			size_t offset = b * block_size_;
+			if (p.blocks[b] != REQUESTED || !accept_block(index, static_cast<uint32_t>(offset))){
+				continue;
+			}
+			size_t len = piece_length(index) - offset;
+			piece_index = index;
+			begin = static_cast<uint32_t>(offset);
+			length = static_cast<uint32_t>(len < block_size_ ? len : block_size_);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool PieceAssembler::start_piece(int piece_index, uint32_t& begin, uint32_t& length){
+	if (piece_index < 0 || piece_index >= total_pieces_){
+		return false;
+	}
+	std::lock_guard<std::mutex> lck(mu_);
+	auto it = partials_.find(piece_index);
+	if (it == partials_.end()){
+		size_t len = piece_length(piece_index);
+		Partial p;
+		p.data = pool_ ? pool_->acquire(len) : std::make_shared<std::vector<char>>(len);
+		p.blocks.assign((len + block_size_ - 1) / block_size_, MISSING);
+		it = partials_.emplace(piece_index, std::move(p)).first;
+	}
+	return reserve_in(it->second, piece_index, begin, length);
+}
+
+bool PieceAssembler::in_progress(int piece_index) const {
+	std::lock_guard<std::mutex> lck(mu_);
+	return partials_.count(piece_index) != 0;
+}
+
+void PieceAssembler::release(int piece_index, uint32_t begin){
+	std::lock_guard<std::mutex> lck(mu_);
+	auto it = partials_.find(piece_index);
+	if (it == partials_.end()){
+		return;
+	}
+	size_t b = begin / block_size_;
+	if (b < it->second.blocks.size() && it->second.blocks[b] == REQUESTED){
+		it->second.blocks[b] = MISSING;
+	}
+}
+
+PieceAssembler::BlockResult PieceAssembler::add_block(int piece_index, uint32_t begin, std::span<const char> data, uint32_t from,
+	BufferPool::Buffer& piece, std::vector<uint32_t>& contributors){
+	std::lock_guard<std::mutex> lck(mu_);
+	auto it = partials_.find(piece_index);
+	if (it == partials_.end()){
+		return BlockResult::Rejected;
+	}
+	Partial& p = it->second;
+
+	if (begin % block_size_ != 0){
+		return BlockResult::Rejected;
+	}
+	size_t b = begin / block_size_;
+	if (b >= p.blocks.size() || p.blocks[b] == RECEIVED){
+		return BlockResult::Rejected;
+	}
+	size_t expected = p.data->size() - begin;
+	if (expected > block_size_){
+		expected = block_size_;
+	}
+	if (data.size() != expected){
+		return BlockResult::Rejected;
+	}
+
+	//a released block may still arrive late, that's fine as long as nobody else delivered it first
+	std::memcpy(p.data->data() + begin, data.data(), data.size());
+	p.blocks[b] = RECEIVED;
+	p.received++;
+	if (std::find(p.contributors.begin(), p.contributors.end(), from) == p.contributors.end()){
+		p.contributors.push_back(from);
+	}
+
+	if (p.received < p.blocks.size()){
+		return BlockResult::Stored;
+	}
+	piece = std::move(p.data);
+	contributors = std::move(p.contributors);
+	partials_.erase(it);
+	return BlockResult::Completed;
+}
@@ -0,0 +1,87 @@
+#include "PieceCache.hpp"
+
+PieceCache::PieceCache(size_t budget)
+	: budget_(budget), shard_budget_(budget / SHARDS){}
+
+PieceCache::Piece PieceCache::get(int piece_index){
+	Shard& s = shard_of(piece_index);
+	std::lock_guard<std::mutex> lck(s.mu);
+	auto it = s.pieces.find(piece_index);
+	if (it == s.pieces.end()){
+		s.misses++;
+		return nullptr;
+	}
+	s.hits++;
+	s.lru.splice(s.lru.begin(), s.lru, it->second.second);
+	return it->second.first;
+}
+
+bool PieceCache::contains(int piece_index) const {
+	const Shard& s = shard_of(piece_index);
+	std::lock_guard<std::mutex> lck(s.mu);
+	return s.pieces.count(piece_index) != 0;
+}
+
+void PieceCache::insert(int piece_index, Piece piece){
+	if (!piece || piece->size() > shard_budget_){
+		return; //would evict the whole shard and still not fit
+	}
+	Shard& s = shard_of(piece_index);
+	std::lock_guard<std::mutex> lck(s.mu);
+	auto it = s.pieces.find(piece_index);
+	if (it != s.pieces.end()){
+		s.bytes -= it->second.first->size();
+		s.lru.erase(it->second.second);
+		s.pieces.erase(it);
+	}
+
+	while (!s.lru.empty() && s.bytes + piece->size() > shard_budget_){
+		auto victim = s.pieces.find(s.lru.back());
+		s.bytes -= victim->second.first->size();
+		s.pieces.erase(victim);
+		s.lru.pop_back();
+		s.evictions++;
+	}
+
+	s.bytes += piece->size();
+	s.lru.push_front(piece_index);
+	s.pieces.emplace(piece_index, std::make_pair(std::move(piece), s.lru.begin()));
+}
+
+bool PieceCache::begin_fill(int piece_index){
+	if (contains(piece_index)){
+		return false;
+	}
+	std::lock_guard<std::mutex> lck(fill_mu_);
+	if (filling_.size() >= MAX_FILLS){
+		return false;
+	}
+	return filling_.insert(piece_index).second;
+}
+
+void PieceCache::end_fill(int piece_index, Piece piece){
+	bool filled = piece != nullptr;
+	if (filled){
+		insert(piece_index, std::move(piece));
+	}
+	std::lock_guard<std::mutex> lck(fill_mu_);
+	filling_.erase(piece_index);
+	if (filled){
+		fills_++;
+	}
+}
+
+PieceCache::Stats PieceCache::stats() const {
+	Stats st;
+	for (const Shard& s : shards_){
+		std::lock_guard<std::mutex> lck(s.mu);
+		st.hits += s.hits;
+		st.misses += s.misses;
+		st.evictions += s.evictions;
+		st.bytes += s.bytes;
+		st.pieces += s.pieces.size();
+	}
+	std::lock_guard<std::mutex> lck(fill_mu_);
+	st.fills = fills_;
+	return st;
+}
@@ -0,0 +1,184 @@
+#include "PiecePicker.hpp"
+#include <algorithm>
+
+PiecePicker::PiecePicker(const Bitfield& have, PickPolicy policy)
+	: total_pieces_(static_cast<int>(have.size())),
+	policy_(policy),
+	count_(have.size(), 0),
+	pos_(have.size(), -1),
+	buckets_(1),
+	done_(have),
+	none_(have.size(), false),
+	rng_(std::random_device{}()){
+	for (int i = 0; i < total_pieces_; ++i){
+		if (!done_.test(i)){
+			link(i);
+		}
+	}
+}
+
+void PiecePicker::link(int piece_index){
+	uint32_t c = count_[piece_index];
+	if (buckets_.size() <= c){
+		buckets_.resize(c + 1);
+	}
+	pos_[piece_index] = static_cast<int>(buckets_[c].size());
+	buckets_[c].push_back(piece_index);
+}
+
+void PiecePicker::unlink(int piece_index){
+	std::vector<int>& b = buckets_[count_[piece_index]];
+	int p = pos_[piece_index];
+	int last = b.back();
+	b[p] = last;
+	pos_[last] = p;
+	b.pop_back();
+	pos_[piece_index] = -1;
+}
+
+void PiecePicker::add(int piece_index, int delta){
+	if (delta < 0 && count_[piece_index] == 0){
+		return;
+	}
+	bool linked = pos_[piece_index] >= 0;
+	if (linked){
+		unlink(piece_index);
+	}
+	count_[piece_index] += delta;
+	if (linked){
+		link(piece_index);
+	}
+}
+
+void PiecePicker::add_peer(const Bitfield& pieces){
+	std::lock_guard<std::mutex> lck(mu_);
+	for (long i = Bitfield::first_and_not(pieces, none_); i >= 0 && i < total_pieces_; i = Bitfield::first_and_not(pieces, none_, i + 1)){
+		add(static_cast<int>(i), 1);
+	}
+}
+
+void PiecePicker::remove_peer(const Bitfield& pieces){
+	std::lock_guard<std::mutex> lck(mu_);
+	for (long i = Bitfield::first_and_not(pieces, none_); i >= 0 && i < total_pieces_; i = Bitfield::first_and_not(pieces, none_, i + 1)){
+		add(static_cast<int>(i), -1);
+	}
+}
+
+void PiecePicker::on_have(int piece_index){
+	if (piece_index < 0 || piece_index >= total_pieces_){
+		return;
+	}
+	std::lock_guard<std::mutex> lck(mu_);
+	add(piece_index, 1);
+}
+
+void PiecePicker::on_complete(int piece_index){
+	if (piece_index < 0 || piece_index >= total_pieces_){
+		return;
+	}
+	std::lock_guard<std::mutex> lck(mu_);
+	if (done_.set(piece_index) && pos_[piece_index] >= 0){
+		unlink(piece_index);
+	}
+	reserved_.erase(piece_index);
+}
+
+uint32_t PiecePicker::availability(int piece_index) const {
+	if (piece_index < 0 || piece_index >= total_pieces_){
+		return 0;
+	}
+	std::lock_guard<std::mutex> lck(mu_);
+	return count_[piece_index];
+}
+
+std::vector<int> PiecePicker::rarest_missing(const Bitfield& ours, const Bitfield& theirs, size_t k, int skip) const {
+	std::vector<int> out;
+	if (k == 0){
+		return out;
+	}
+	std::lock_guard<std::mutex> lck(mu_);
+	for (long i = Bitfield::first_and_not(ours, theirs); i >= 0 && i < total_pieces_; i = Bitfield::first_and_not(ours, theirs, i + 1)){
+		int piece = static_cast<int>(i);
+		if (piece == skip){
+			continue;
+		}
+		//k is a handful, keep the best k sorted by insertion
+		if (out.size() == k && count_[out.back()] <= count_[piece]){
+			continue;
+		}
+		if (out.size() == k){
+			out.pop_back();
+		}
+		auto at = std::upper_bound(out.begin(), out.end(), piece, [this](int a, int b){ return count_[a] < count_[b]; });
+		out.insert(at, piece);
+	}
+	return out;
+}
+
+int PiecePicker::pick(const Bitfield& theirs, const std::function<bool(int)>& accept){
+	std::lock_guard<std::mutex> lck(mu_);
+	return pick_unreserved(theirs, accept);
+}
+
+int PiecePicker::pick_and_reserve(const Bitfield& theirs, uint32_t peer, const std::function<bool(int)>& accept){
+	std::lock_guard<std::mutex> lck(mu_);
+	int i = pick_unreserved(theirs, accept);
+	if (i >= 0){
+		reserved_[i] = peer;
+	}
+	return i;
+}
+
+void PiecePicker::release(int piece_index, uint32_t peer){
+	std::lock_guard<std::mutex> lck(mu_);
+	auto it = reserved_.find(piece_index);
+	if (it != reserved_.end() && it->second == peer){
+		reserved_.erase(it);
+	}
+}
+
+void PiecePicker::release_peer(uint32_t peer){
+	std::lock_guard<std::mutex> lck(mu_);
+	std::erase_if(reserved_, [peer](const auto& r){ return r.second == peer; });
+}
+
+bool PiecePicker::reserved(int piece_index) const {
+	std::lock_guard<std::mutex> lck(mu_);
+	return reserved_.count(piece_index) != 0;
+}
+
+int PiecePicker::pick_unreserved(const Bitfield& theirs, const std::function<bool(int)>& accept){
+	auto free = [this, &accept](int i){ return reserved_.count(i) == 0 && accept(i); };
+	if (policy_ == PickPolicy::Sequential){
+		return pick_sequential(theirs, free);
+	}
+	return pick_rarest(theirs, free);
+}
+
+//bucket 0 is skipped, nobody has those. the random start spreads neighbors over the pieces of a bucket
+//instead of everyone converging on the same one
+int PiecePicker::pick_rarest(const Bitfield& theirs, const std::function<bool(int)>& accept){
+	for (size_t c = 1; c < buckets_.size(); ++c){
+		const std::vector<int>& b = buckets_[c];
+		if (b.empty()){
+			continue;
+		}
+		size_t start = rng_() % b.size();
+		for (size_t k = 0; k < b.size(); ++k){
+			int i = b[(start + k) % b.size()];
+			if (theirs.test(i) && accept(i)){
+				return i;
+			}
+		}
+	}
+	return -1;
+}
+
+int PiecePicker::pick_sequential(const Bitfield& theirs, const std::function<bool(int)>& accept){
+	for (long i = Bitfield::first_and_not(theirs, done_); i >= 0; i = Bitfield::first_and_not(theirs, done_, i + 1)){
+		if (accept(static_cast<int>(i))){
+			return static_cast<int>(i);
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,243 @@
+#include "PieceStore.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+PieceStore::PieceStore(const std::string& path, size_t file_size, size_t piece_size, int total_pieces,
+	IoEngine* io, const StoreOptions& options)
+	: path_(path),
+	file_size_(file_size),
+	piece_size_(piece_size),
+	total_pieces_(total_pieces),
+	io_(io),
+	options_(options){
+	if (options_.flush_batch == 0){
+		options_.flush_batch = 1;
+	}
+	resume_ = new ResumeFile(path_ + ".resume", file_size_, piece_size_, total_pieces_);
+}
+
+PieceStore::~PieceStore(){
+	if (fd_ >= 0){
+		//fsync so the mtime stamped into the resume file is the one the next run will see
+		struct stat st{};
+		if (sync() && fsync(fd_) == 0 && fstat(fd_, &st) == 0){
+			resume_->close(static_cast<size_t>(st.st_size), st.st_mtim);
+		}
+		if (map_){
+			munmap(map_, file_size_);
+			map_ = nullptr;
+		}
+		close(fd_);
+		fd_ = -1;
+	}
+	delete resume_;
+}
+
+bool PieceStore::open(){
+	fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd_ < 0){
+		return false;
+	}
+
+	struct stat st{};
+	if (fstat(fd_, &st) == 0){
+		initial_size_ = static_cast<size_t>(st.st_size);
+	}
+
+	//reserve the blocks up front so pieces arriving out of order don't fragment the file
+	//KEEP_SIZE leaves the visible size alone, the startup probe still goes by it
+	bool sparse = options_.mode == StoreMode::Mmap && options_.map_writable; //holes mark unwritten pieces
+	if (initial_size_ < file_size_ && !sparse){
+		int r = fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(file_size_));
+		(void)r; //not every file system supports it, the writes allocate as they go then
+	}
+
+	if (io_ && io_->uring()){
+		io_->attach_file(fd_);
+	}
+
+	if (options_.mode == StoreMode::Mmap){
+		map_file();
+	}
+	return true;
+}
+
+//seeds map the complete file read-only; leechers only with map_writable, after growing the file to
+//its full size (a mapping can't extend a file). if mapping fails the store stays on pread/pwrite
+void PieceStore::map_file(){
+	bool complete = initial_size_ >= file_size_;
+	if (file_size_ == 0 || (!complete && !options_.map_writable)){
+		return;
+	}
+	if (!complete && ftruncate(fd_, static_cast<off_t>(file_size_)) != 0){
+		return;
+	}
+
+	int prot = complete && !options_.map_writable ? PROT_READ : PROT_READ | PROT_WRITE;
+	void* m = mmap(nullptr, file_size_, prot, MAP_SHARED, fd_, 0);
+	if (m == MAP_FAILED){
+		return;
+	}
+	map_ = static_cast<char*>(m);
+	map_writable_ = (prot & PROT_WRITE) != 0;
+
+	int advice = MADV_NORMAL;
+	if (options_.advice == MapAdvice::Sequential){
+		advice = MADV_SEQUENTIAL;
+	} else if (options_.advice == MapAdvice::Random){
+		advice = MADV_RANDOM;
+	}
+	madvise(map_, file_size_, advice);
+}
+
+const char* PieceStore::mapped(int piece_index) const {
+	if (map_ == nullptr || piece_index < 0 || piece_index >= total_pieces_){
+		return nullptr;
+	}
+	return map_ + static_cast<size_t>(piece_index) * piece_size_;
+}
+
+size_t PieceStore::piece_length(int piece_index) const {
+	if (piece_index == total_pieces_ - 1){
+		return file_size_ - static_cast<size_t>(piece_index) * piece_size_;
+	}
+	return piece_size_;
+}
+
+bool PieceStore::read_piece(int piece_index, std::vector<char>& piece_data){
+	if (piece_index < 0 || piece_index >= total_pieces_){
+		return false;
+	}
+	size_t len = piece_length(piece_index);
+	off_t offset = static_cast<off_t>(piece_index) * piece_size_;
+	piece_data.resize(len);
+
+	if (map_){
+		std::memcpy(piece_data.data(), map_ + offset, len);
+		return true;
+	}
+	if (io_ && io_->uring()){
+		return io_->read_file(piece_data.data(), len, offset);
+	}
+
+	size_t done = 0;
+	while (done < len){
+		ssize_t r = pread(fd_, piece_data.data() + done, len - done, offset + static_cast<off_t>(done));
+		if (r < 0 && errno == EINTR){
+			continue;
+		}
+		if (r <= 0){
+			return false;
+		}
+		done += static_cast<size_t>(r);
+	}
+	return true;
+}
+
+bool PieceStore::write_piece(int piece_index, std::span<const char> piece_data){
+	if (piece_index < 0 || piece_index >= total_pieces_ || piece_data.size() != piece_length(piece_index)){
+		return false;
+	}
+	off_t offset = static_cast<off_t>(piece_index) * piece_size_;
+
+	if (map_writable_){
+		std::memcpy(map_ + offset, piece_data.data(), piece_data.size());
+	} else if (io_ && io_->uring()){
+		if (!io_->write_file(piece_data.data(), piece_data.size(), offset)){
+			return false;
+		}
+	} else {
+		size_t done = 0;
+		while (done < piece_data.size()){
+			ssize_t w = pwrite(fd_, piece_data.data() + done, piece_data.size() - done, offset + static_cast<off_t>(done));
+			if (w < 0 && errno == EINTR){
+				continue;
+			}
+			if (w <= 0){
+				return false;
+			}
+			done += static_cast<size_t>(w);
+		}
+	}
+
+	size_t pending = 0;
+	{
+		std::lock_guard<std::mutex> lck(unsynced_mu_);
+		unsynced_.push_back(piece_index);
+		pending = unsynced_.size();
+	}
+	if (options_.flush_policy == FlushPolicy::Piece || (options_.flush_policy == FlushPolicy::Batch && pending >= options_.flush_batch)){
+		return sync();
+	}
+	return true;
+}
+
+bool PieceStore::on_disk(int piece_index) const {
+	if (piece_index < 0 || piece_index >= total_pieces_){
+		return false;
+	}
+	size_t offset = static_cast<size_t>(piece_index) * piece_size_;
+	size_t end = offset + piece_length(piece_index);
+	if (initial_size_ < end){
+		return false;
+	}
+	//a file grown up front (writable mapping) is sparse where nothing was written yet
+	off_t hole = lseek(fd_, static_cast<off_t>(offset), SEEK_HOLE);
+	return hole < 0 || static_cast<size_t>(hole) >= end;
+}
+
+bool PieceStore::load_resume(std::vector<uint8_t>& bitfield, bool& clean){
+	struct stat st{};
+	if (fstat(fd_, &st) != 0 || !resume_->load(static_cast<size_t>(st.st_size), st.st_mtim, bitfield, clean)){
+		return false;
+	}
+	if (clean){
+		return true;
+	}
+	//the last run didn't shut down cleanly or the file changed since, drop what plainly isn't there anymore
+	for (int i = 0; i < total_pieces_; ++i){
+		uint8_t bit = static_cast<uint8_t>(0x80 >> (i % 8));
+		if ((bitfield[i / 8] & bit) != 0 && !on_disk(i)){
+			bitfield[i / 8] &= static_cast<uint8_t>(~bit);
+		}
+	}
+	return true;
+}
+
+bool PieceStore::reset_resume(const std::vector<uint8_t>& bitfield){
+	std::lock_guard<std::mutex> lck(sync_mu_);
+	return resume_->reset(bitfield);
+}
+
+bool PieceStore::sync(){
+	std::lock_guard<std::mutex> lck(sync_mu_);
+	std::vector<int> pieces;
+	{
+		std::lock_guard<std::mutex> l(unsynced_mu_);
+		pieces.swap(unsynced_);
+	}
+	if (pieces.empty()){
+		return true;
+	}
+
+	bool ok = map_writable_ ? msync(map_, file_size_, MS_SYNC) == 0 : fdatasync(fd_) == 0;
+	if (!ok){
+		std::lock_guard<std::mutex> l(unsynced_mu_);
+		unsynced_.insert(unsynced_.end(), pieces.begin(), pieces.end());
+		return false;
+	}
+
+	//only now are these pieces safe to remember across a restart
+	resume_->mark(pieces);
+	return true;
+}
+
+void PieceStore::on_complete(){
+	if (options_.flush_policy != FlushPolicy::Piece){
+		sync();
+	}
+}
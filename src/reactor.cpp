@@ -0,0 +1,209 @@
+#include "Reactor.hpp"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static const int MAX_EVENTS = 64;
+
+Reactor::Reactor(unsigned int num_threads, ReadHandler on_readable, WriteHandler on_writable, CloseHandler on_closed)
+	: on_readable_(std::move(on_readable)),
+	on_writable_(std::move(on_writable)),
+	on_closed_(std::move(on_closed)),
+	running_(false){
+
+	if (num_threads == 0){
+		num_threads = std::thread::hardware_concurrency();
+	}
+	if (num_threads == 0){
+		num_threads = 1;
+	}
+	for (unsigned int i = 0; i < num_threads; ++i){
+		shards_.push_back(new Shard());
+	}
+}
+
+Reactor::~Reactor(){
+	stop();
+	for (auto* s : shards_){
+		if (s->epoll_fd >= 0){
+			close(s->epoll_fd);
+		}
+		if (s->wake_fd >= 0){
+			close(s->wake_fd);
+		}
+		delete s;
+	}
+}
+
+bool Reactor::start(){
+	bool expected = false;
+	if (!running_.compare_exchange_strong(expected, true)){
+		return true; //already running
+	}
+
+	for (auto* s : shards_){
+		s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		s->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (s->epoll_fd < 0 || s->wake_fd < 0){
+			stop();
+			return false;
+		}
+
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.fd = s->wake_fd;
+		if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->wake_fd, &ev) < 0){
+			stop();
+			return false;
+		}
+		s->thread = std::thread(&Reactor::run, this, s);
+	}
+	return true;
+}
+
+void Reactor::stop(){
+	running_ = false;
+	for (auto* s : shards_){
+		if (s->wake_fd >= 0){
+			uint64_t one = 1;
+			ssize_t w = write(s->wake_fd, &one, sizeof(one));
+			(void)w;
+		}
+	}
+	for (auto* s : shards_){
+		if (s->thread.joinable()){
+			s->thread.join();
+		}
+	}
+}
+
+bool Reactor::add(int sock){
+	int flags = fcntl(sock, F_GETFL, 0);
+	if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0){
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lck(owner_mu_);
+
+	Shard* target = shards_.front();
+	for (auto* s : shards_){
+		if (s->load < target->load){
+			target = s;
+		}
+	}
+
+	epoll_event ev{};
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.fd = sock;
+	if (epoll_ctl(target->epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0){
+		return false;
+	}
+	owner_[sock] = Watch{target, false};
+	target->load++;
+	return true;
+}
+
+void Reactor::set_writable(int sock, bool on){
+	std::lock_guard<std::mutex> lck(owner_mu_);
+	auto it = owner_.find(sock);
+	if (it == owner_.end() || it->second.writable == on){
+		return;
+	}
+	epoll_event ev{};
+	ev.events = EPOLLIN | EPOLLRDHUP | (on ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+	ev.data.fd = sock;
+	if (epoll_ctl(it->second.shard->epoll_fd, EPOLL_CTL_MOD, sock, &ev) == 0){
+		it->second.writable = on;
+	}
+}
+
+void Reactor::remove(int sock){
+	std::lock_guard<std::mutex> lck(owner_mu_);
+	auto it = owner_.find(sock);
+	if (it == owner_.end()){
+		return;
+	}
+	epoll_ctl(it->second.shard->epoll_fd, EPOLL_CTL_DEL, sock, nullptr);
+	it->second.shard->load--;
+	owner_.erase(it);
+}
+
+bool Reactor::post(int sock, std::function<void()> task){
+	Shard* shard = nullptr;
+	{
+		std::lock_guard<std::mutex> lck(owner_mu_);
+		auto it = owner_.find(sock);
+		if (it == owner_.end()){
+			return false;
+		}
+		shard = it->second.shard;
+	}
+	{
+		std::lock_guard<std::mutex> lck(shard->tasks_mu);
+		shard->tasks.push_back(std::move(task));
+	}
+	uint64_t one = 1;
+	ssize_t w = write(shard->wake_fd, &one, sizeof(one));
+	(void)w;
+	return true;
+}
+
+void Reactor::run_tasks(Shard* shard){
+	uint64_t count = 0;
+	ssize_t r = read(shard->wake_fd, &count, sizeof(count));
+	(void)r;
+
+	std::deque<std::function<void()>> tasks;
+	{
+		std::lock_guard<std::mutex> lck(shard->tasks_mu);
+		tasks.swap(shard->tasks);
+	}
+	for (auto& task : tasks){
+		task();
+	}
+}
+
+//called on the owning shard thread once a handler gives up on a socket
+void Reactor::drop(int sock){
+	remove(sock);
+	if (on_closed_){
+		on_closed_(sock);
+	}
+}
+
+void Reactor::run(Shard* shard){
+	epoll_event events[MAX_EVENTS];
+
+	while (running_){
+		int n = epoll_wait(shard->epoll_fd, events, MAX_EVENTS, -1);
+		if (n < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			break;
+		}
+
+		for (int i = 0; i < n && running_; ++i){
+			int fd = events[i].data.fd;
+			if (fd == shard->wake_fd){
+				run_tasks(shard);
+				continue;
+			}
+			//queued output goes first so replies produced by the read handler find the socket drained
+			uint32_t ev = events[i].events;
+			bool ok = true;
+			if ((ev & EPOLLOUT) && on_writable_){
+				ok = on_writable_(fd);
+			}
+			//errors and hangups are reported through the read handler (recv returns 0 or -1)
+			if (ok && (ev & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))){
+				ok = on_readable_(fd);
+			}
+			if (!ok){
+				drop(fd);
+			}
+		}
+	}
+}
@@ -0,0 +1,172 @@
+#include "ResumeFile.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char RESUME_MAGIC[8] = {'P', '2', 'P', 'R', 'E', 'S', 'U', 'M'};
+static const uint32_t RESUME_VERSION = 3;
+
+static bool write_all_at(int fd, const void* buf, size_t len, off_t offset){
+	const char* p = static_cast<const char*>(buf);
+	while (len > 0){
+		ssize_t w = pwrite(fd, p, len, offset);
+		if (w < 0 && errno == EINTR){
+			continue;
+		}
+		if (w <= 0){
+			return false;
+		}
+		p += w;
+		len -= static_cast<size_t>(w);
+		offset += w;
+	}
+	return true;
+}
+
+static bool read_all_at(int fd, void* buf, size_t len, off_t offset){
+	char* p = static_cast<char*>(buf);
+	while (len > 0){
+		ssize_t r = pread(fd, p, len, offset);
+		if (r < 0 && errno == EINTR){
+			continue;
+		}
+		if (r <= 0){
+			return false;
+		}
+		p += r;
+		len -= static_cast<size_t>(r);
+		offset += r;
+	}
+	return true;
+}
+
+ResumeFile::ResumeFile(const std::string& path, size_t file_size, size_t piece_size, int total_pieces)
+	: path_(path),
+	file_size_(file_size),
+	piece_size_(piece_size),
+	total_pieces_(total_pieces),
+	bits_((total_pieces + 7) / 8, 0){}
+
+ResumeFile::~ResumeFile(){
+	if (fd_ >= 0){
+		::close(fd_);
+		fd_ = -1;
+	}
+}
+
+ResumeFile::Header ResumeFile::make_header() const {
+	Header h{};
+	std::memcpy(h.magic, RESUME_MAGIC, sizeof(h.magic));
+	h.version = RESUME_VERSION;
+	h.total_pieces = static_cast<uint32_t>(total_pieces_);
+	h.generation = generation_;
+	h.file_size = file_size_;
+	h.piece_size = piece_size_;
+	return h;
+}
+
+bool ResumeFile::load(size_t data_size, const timespec& data_mtime, std::vector<uint8_t>& bitfield, bool& clean){
+	std::lock_guard<std::mutex> lck(mu_);
+	int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0){
+		return false;
+	}
+
+	Header h{};
+	std::vector<uint8_t> bits(bits_.size());
+	bool ok = read_all_at(fd, &h, sizeof(h), 0) && read_all_at(fd, bits.data(), bits.size(), sizeof(h));
+	::close(fd);
+	if (!ok){
+		return false;
+	}
+
+	generation_ = h.generation; //carry on counting even if the state belongs to another file
+	if (std::memcmp(h.magic, RESUME_MAGIC, sizeof(h.magic)) != 0 || h.version != RESUME_VERSION
+		|| h.total_pieces != static_cast<uint32_t>(total_pieces_) || h.file_size != file_size_ || h.piece_size != piece_size_){
+		return false;
+	}
+
+	clean = h.clean != 0 && h.data_size == data_size
+		&& h.mtime_sec == static_cast<int64_t>(data_mtime.tv_sec) && h.mtime_nsec == static_cast<int64_t>(data_mtime.tv_nsec);
+	bitfield = bits;
+	return true;
+}
+
+bool ResumeFile::reset(const std::vector<uint8_t>& bitfield){
+	std::lock_guard<std::mutex> lck(mu_);
+	if (fd_ >= 0){
+		::close(fd_);
+		fd_ = -1;
+	}
+
+	bits_.assign(bits_.size(), 0);
+	std::memcpy(bits_.data(), bitfield.data(), std::min(bits_.size(), bitfield.size()));
+	generation_++;
+	Header h = make_header();
+
+	//a crash halfway leaves the old file in place rather than a torn one
+	std::string tmp = path_ + ".tmp";
+	int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0){
+		return false;
+	}
+	if (!write_all_at(fd, &h, sizeof(h), 0) || !write_all_at(fd, bits_.data(), bits_.size(), sizeof(h))
+		|| fdatasync(fd) != 0 || rename(tmp.c_str(), path_.c_str()) != 0){
+		::close(fd);
+		unlink(tmp.c_str());
+		return false;
+	}
+	fd_ = fd;
+	sync_dir();
+	return true;
+}
+
+bool ResumeFile::mark(const std::vector<int>& pieces){
+	std::lock_guard<std::mutex> lck(mu_);
+	if (fd_ < 0){
+		return false;
+	}
+
+	for (int piece : pieces){
+		if (piece < 0 || piece >= total_pieces_){
+			continue;
+		}
+		size_t byte = static_cast<size_t>(piece) / 8;
+		bits_[byte] |= static_cast<uint8_t>(0x80 >> (piece % 8));
+		if (!write_all_at(fd_, &bits_[byte], 1, static_cast<off_t>(sizeof(Header) + byte))){
+			return false;
+		}
+	}
+	generation_++;
+	Header h = make_header();
+	return write_all_at(fd_, &h, sizeof(h), 0) && fdatasync(fd_) == 0;
+}
+
+bool ResumeFile::close(size_t data_size, const timespec& data_mtime){
+	std::lock_guard<std::mutex> lck(mu_);
+	if (fd_ < 0){
+		return false;
+	}
+	Header h = make_header();
+	h.clean = 1;
+	h.data_size = data_size;
+	h.mtime_sec = static_cast<int64_t>(data_mtime.tv_sec);
+	h.mtime_nsec = static_cast<int64_t>(data_mtime.tv_nsec);
+	bool ok = write_all_at(fd_, &h, sizeof(h), 0) && fdatasync(fd_) == 0;
+	::close(fd_);
+	fd_ = -1;
+	return ok;
+}
+
+//makes the rename in reset() survive a crash
+void ResumeFile::sync_dir() const {
+	size_t slash = path_.find_last_of('/');
+	std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path_.substr(0, slash));
+	int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd >= 0){
+		fsync(fd);
+		::close(fd);
+	}
+}
@@ -0,0 +1,167 @@
+#include "Sha256.hpp"
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA256_X86 1
+#endif
+
+namespace sha256 {
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t INITIAL_STATE[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static inline uint32_t rotr(uint32_t x, int n){ return (x >> n) | (x << (32 - n)); }
+
+static void compress_scalar(uint32_t state[8], const uint8_t* data, size_t blocks){
+	uint32_t w[64];
+	while (blocks--){
+		for (int i = 0; i < 16; ++i){
+			w[i] = (static_cast<uint32_t>(data[4 * i]) << 24) | (static_cast<uint32_t>(data[4 * i + 1]) << 16)
+				| (static_cast<uint32_t>(data[4 * i + 2]) << 8) | static_cast<uint32_t>(data[4 * i + 3]);
+		}
+		for (int i = 16; i < 64; ++i){
+			uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+		for (int i = 0; i < 64; ++i){
+			uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+			uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+		data += 64;
+	}
+}
+
+#ifdef SHA256_X86
+//four rounds per step with sha256rnds2, message schedule with sha256msg1/msg2
+__attribute__((target("sha,sse4.1")))
+static void compress_shani(uint32_t state[8], const uint8_t* data, size_t blocks){
+	const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+	__m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0]));
+	__m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4]));
+	tmp = _mm_shuffle_epi32(tmp, 0xB1);
+	state1 = _mm_shuffle_epi32(state1, 0x1B);
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8); //ABEF
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);       //CDGH
+
+	while (blocks--){
+		__m128i abef = state0;
+		__m128i cdgh = state1;
+		__m128i w[4];
+
+		#pragma GCC unroll 16
+		for (int i = 0; i < 16; ++i){
+			if (i < 4){
+				w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)), MASK);
+			}
+			__m128i msg = _mm_add_epi32(w[i % 4], _mm_loadu_si128(reinterpret_cast<const __m128i*>(&K[4 * i])));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			if (i >= 3 && i <= 14){
+				__m128i t = _mm_alignr_epi8(w[i % 4], w[(i + 3) % 4], 4);
+				w[(i + 1) % 4] = _mm_add_epi32(w[(i + 1) % 4], t);
+				w[(i + 1) % 4] = _mm_sha256msg2_epu32(w[(i + 1) % 4], w[i % 4]);
+			}
+			msg = _mm_shuffle_epi32(msg, 0x0E);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+			if (i >= 1 && i <= 12){
+				w[(i + 3) % 4] = _mm_sha256msg1_epu32(w[(i + 3) % 4], w[i % 4]);
+			}
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+		data += 64;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+
+static bool cpu_has_sha(){
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+using Compress = void (*)(uint32_t*, const uint8_t*, size_t);
+
+static Compress pick_compress(){
+#ifdef SHA256_X86
+	if (cpu_has_sha()){
+		return compress_shani;
+	}
+#endif
+	return compress_scalar;
+}
+
+static const Compress compress = pick_compress();
+
+bool accelerated(){
+	return compress != compress_scalar;
+}
+
+static Digest hash_with(Compress blocks_fn, const void* data, size_t len){
+	uint32_t state[8];
+	std::memcpy(state, INITIAL_STATE, sizeof(state));
+
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	size_t full = len / 64;
+	if (full > 0){
+		blocks_fn(state, p, full);
+	}
+
+	//padding: 0x80, zeros, then the bit length big-endian (one or two final blocks)
+	uint8_t tail[128] = {0};
+	size_t rest = len % 64;
+	std::memcpy(tail, p + full * 64, rest);
+	tail[rest] = 0x80;
+	size_t tail_blocks = rest < 56 ? 1 : 2;
+	uint64_t bits = static_cast<uint64_t>(len) * 8;
+	for (int i = 0; i < 8; ++i){
+		tail[tail_blocks * 64 - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+	}
+	blocks_fn(state, tail, tail_blocks);
+
+	Digest out;
+	for (int i = 0; i < 8; ++i){
+		out[4 * i] = static_cast<uint8_t>(state[i] >> 24);
+		out[4 * i + 1] = static_cast<uint8_t>(state[i] >> 16);
+		out[4 * i + 2] = static_cast<uint8_t>(state[i] >> 8);
+		out[4 * i + 3] = static_cast<uint8_t>(state[i]);
+	}
+	return out;
+}
+
+Digest hash(const void* data, size_t len){
+	return hash_with(compress, data, len);
+}
+
+Digest hash_portable(const void* data, size_t len){
+	return hash_with(compress_scalar, data, len);
+}
+
+}
@@ -0,0 +1,108 @@
+#include "SuperSeeder.hpp"
+
+SuperSeeder::SuperSeeder(int total_pieces, const PiecePicker& picker)
+	: total_pieces_(total_pieces),
+	picker_(picker),
+	reveals_(total_pieces, 0),
+	seen_(total_pieces, false),
+	rng_(std::random_device{}()){
+}
+
+bool SuperSeeder::mark_seen(int piece_index){
+	if (piece_index < 0 || piece_index >= total_pieces_ || !seen_.set(piece_index)){
+		return false;
+	}
+	++seen_count_;
+	return true;
+}
+
+void SuperSeeder::add_peer(const Bitfield& pieces){
+	std::lock_guard<std::mutex> lck(mu_);
+	for (long i = Bitfield::first_and_not(pieces, seen_); i >= 0 && i < total_pieces_; i = Bitfield::first_and_not(pieces, seen_, i + 1)){
+		mark_seen(static_cast<int>(i));
+	}
+}
+
+void SuperSeeder::remove_peer(uint32_t peer){
+	std::lock_guard<std::mutex> lck(mu_);
+	offers_.erase(peer);
+}
+
+std::vector<uint32_t> SuperSeeder::on_have(uint32_t from, int piece_index){
+	std::lock_guard<std::mutex> lck(mu_);
+	mark_seen(piece_index);
+	std::vector<uint32_t> next;
+	for (auto& [peer, offer] : offers_){
+		if (offer.piece != piece_index){
+			continue;
+		}
+		if (peer != from){
+			offer.propagated = true;
+			next.push_back(peer);
+		} else if (offer.propagated){
+			next.push_back(peer);
+		}
+	}
+	return next;
+}
+
+//first a piece nobody was shown and nobody has, from a random start so neighbors get different
+//ones, otherwise the least available piece they lack, the one revealed least often on a tie
+int SuperSeeder::reveal(uint32_t peer, const Bitfield& theirs){
+	std::lock_guard<std::mutex> lck(mu_);
+	if (total_pieces_ == 0){
+		return -1;
+	}
+	int start = static_cast<int>(rng_() % total_pieces_);
+	int best = -1;
+	for (int k = 0; k < total_pieces_; ++k){
+		int i = (start + k) % total_pieces_;
+		if (!theirs.test(i) && reveals_[i] == 0 && !seen_.test(i)){
+			best = i;
+			break;
+		}
+	}
+	if (best < 0){
+		uint32_t best_count = 0;
+		for (int k = 0; k < total_pieces_; ++k){
+			int i = (start + k) % total_pieces_;
+			if (theirs.test(i)){
+				continue;
+			}
+			uint32_t count = picker_.availability(i);
+			if (best < 0 || count < best_count || (count == best_count && reveals_[i] < reveals_[best])){
+				best = i;
+				best_count = count;
+			}
+		}
+	}
+	if (best < 0){
+		offers_.erase(peer);
+		return -1;
+	}
+	++reveals_[best];
+	offers_[peer] = Offer{best, Clock::now(), false};
+	return best;
+}
+
+int SuperSeeder::revealed(uint32_t peer) const {
+	std::lock_guard<std::mutex> lck(mu_);
+	auto it = offers_.find(peer);
+	return it == offers_.end() ? -1 : it->second.piece;
+}
+
+std::vector<uint32_t> SuperSeeder::stalled(Clock::time_point now, Clock::duration timeout) const {
+	std::lock_guard<std::mutex> lck(mu_);
+	std::vector<uint32_t> out;
+	for (const auto& [peer, offer] : offers_){
+		if (now - offer.at > timeout){
+			out.push_back(peer);
+		}
+	}
+	return out;
+}
+
+bool SuperSeeder::complete() const {
+	std::lock_guard<std::mutex> lck(mu_);
+	return seen_count_ == static_cast<size_t>(total_pieces_);
+}
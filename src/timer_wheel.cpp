@@ -0,0 +1,173 @@
+#include "TimerWheel.hpp"
+#include <algorithm>
+
+TimerWheel::TimerWheel(Clock::duration tick)
+	: tick_(tick > Clock::duration::zero() ? tick : Clock::duration(std::chrono::milliseconds(10))),
+	start_(Clock::now()){
+	thread_ = std::thread(&TimerWheel::run, this);
+}
+
+TimerWheel::~TimerWheel(){
+	stop();
+}
+
+void TimerWheel::stop(){
+	{
+		std::lock_guard<std::mutex> lck(mu_);
+		stopping_ = true;
+		timers_.clear();
+	}
+	cv_.notify_all();
+	if (thread_.joinable()){
+		thread_.join();
+	}
+}
+
+size_t TimerWheel::pending() const {
+	std::lock_guard<std::mutex> lck(mu_);
+	return timers_.size();
+}
+
+TimerWheel::TimerId TimerWheel::after(Clock::duration delay, Task task){
+	return add(delay, 0, std::move(task));
+}
+
+TimerWheel::TimerId TimerWheel::every(Clock::duration period, Task task){
+	return add(period, std::max<uint64_t>(1, to_ticks(period)), std::move(task));
+}
+
+bool TimerWheel::cancel(TimerId id){
+	std::lock_guard<std::mutex> lck(mu_);
+	return timers_.erase(id) != 0;
+}
+
+TimerWheel::TimerId TimerWheel::add(Clock::duration delay, uint64_t period, Task task){
+	bool wake = false;
+	TimerId id = 0;
+	{
+		std::lock_guard<std::mutex> lck(mu_);
+		if (stopping_){
+			return 0;
+		}
+		auto now = Clock::now();
+		if (timers_.empty()){
+			//the thread stopped ticking while there was nothing to run, catch up before placing
+			now_ = std::max(now_, elapsed_ticks(now));
+			wake = true;
+		}
+		uint64_t due = std::max(now_, to_ticks((now - start_) + delay));
+		id = next_id_++;
+		timers_.emplace(id, Timer{due, period, std::move(task)});
+		place(id, due);
+	}
+	if (wake){
+		cv_.notify_all();
+	}
+	return id;
+}
+
+uint64_t TimerWheel::elapsed_ticks(Clock::time_point t) const {
+	return t <= start_ ? 0 : static_cast<uint64_t>((t - start_) / tick_);
+}
+
+//rounded up, a timer never runs before its deadline
+uint64_t TimerWheel::to_ticks(Clock::duration d) const {
+	if (d <= Clock::duration::zero()){
+		return 0;
+	}
+	return static_cast<uint64_t>((d + tick_ - Clock::duration(1)) / tick_);
+}
+
+//the lowest level whose range covers the deadline. past the top level's range the timer waits in
+//its last slot and is placed again from there
+void TimerWheel::place(TimerId id, uint64_t due){
+	const uint64_t range = uint64_t(1) << (SLOT_BITS * LEVELS);
+	uint64_t delta = due - now_;
+	if (delta >= range){
+		due = now_ + range - 1;
+		delta = range - 1;
+	}
+	int level = 0;
+	while (delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))){
+		++level;
+	}
+	wheel_[level][(due >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(id);
+}
+
+//the slot of this level that now_ just reached holds the timers due within its span, they move to
+//the levels below
+void TimerWheel::cascade(int level){
+	std::vector<TimerId> ids;
+	ids.swap(wheel_[level][(now_ >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+	for (TimerId id : ids){
+		auto it = timers_.find(id);
+		if (it != timers_.end()){
+			place(id, it->second.due);
+		}
+	}
+}
+
+//processes the ticks up to target, the tasks due are appended to due
+void TimerWheel::expire(uint64_t target, std::vector<Task>& due){
+	while (now_ <= target){
+		uint64_t t = now_;
+		size_t slot = t & (SLOTS - 1);
+		if (slot == 0){
+			for (int level = 1; level < LEVELS; ++level){
+				cascade(level);
+				if (((t >> (SLOT_BITS * level)) & (SLOTS - 1)) != 0){
+					break;
+				}
+			}
+		}
+		if (!wheel_[0][slot].empty()){
+			std::vector<TimerId> ids;
+			ids.swap(wheel_[0][slot]);
+			for (TimerId id : ids){
+				auto it = timers_.find(id);
+				if (it == timers_.end()){
+					continue; //cancelled
+				}
+				Timer& timer = it->second;
+				if (timer.due > t){
+					place(id, timer.due); //was parked in the top level's last slot
+					continue;
+				}
+				if (timer.period == 0){
+					due.push_back(std::move(timer.task));
+					timers_.erase(it);
+					continue;
+				}
+				due.push_back(timer.task);
+				timer.due = std::max(t + timer.period, target + 1);
+				place(id, timer.due);
+			}
+		}
+		++now_;
+	}
+}
+
+void TimerWheel::run(){
+	std::vector<Task> due;
+	std::unique_lock<std::mutex> lck(mu_);
+	while (!stopping_){
+		if (timers_.empty()){
+			cv_.wait(lck, [this]{ return stopping_ || !timers_.empty(); });
+			continue;
+		}
+		cv_.wait_until(lck, start_ + tick_ * static_cast<Clock::rep>(now_), [this]{ return stopping_; });
+		if (stopping_){
+			break;
+		}
+		expire(elapsed_ticks(Clock::now()), due);
+		if (due.empty()){
+			continue;
+		}
+		lck.unlock();
+		for (auto& task : due){
+			task();
+		}
+		due.clear();
+		lck.lock();
+	}
+}
@@ -0,0 +1,63 @@
+#include "WorkerPool.hpp"
+
+WorkerPool::WorkerPool(unsigned int num_threads){
+	if (num_threads == 0){
+		num_threads = std::thread::hardware_concurrency();
+	}
+	if (num_threads == 0){
+		num_threads = 1;
+	}
+	for (unsigned int i = 0; i < num_threads; ++i){
+		threads_.emplace_back(&WorkerPool::run, this);
+	}
+}
+
+WorkerPool::~WorkerPool(){
+	{
+		std::lock_guard<std::mutex> lck(mu_);
+		stopping_ = true;
+	}
+	work_cv_.notify_all();
+	for (auto& t : threads_){
+		if (t.joinable()){
+			t.join();
+		}
+	}
+}
+
+void WorkerPool::submit(Task task){
+	{
+		std::lock_guard<std::mutex> lck(mu_);
+		tasks_.push_back(std::move(task));
+	}
+	work_cv_.notify_one();
+}
+
+void WorkerPool::wait_idle(){
+	std::unique_lock<std::mutex> lck(mu_);
+	idle_cv_.wait(lck, [this]{ return tasks_.empty() && busy_ == 0; });
+}
+
+void WorkerPool::run(){
+	while (true){
+		Task task;
+		{
+			std::unique_lock<std::mutex> lck(mu_);
+			work_cv_.wait(lck, [this]{ return stopping_ || !tasks_.empty(); });
+			if (tasks_.empty()){
+				return; //stopping and nothing left
+			}
+			task = std::move(tasks_.front());
+			tasks_.pop_front();
+			busy_++;
+		}
+		task();
+		{
+			std::lock_guard<std::mutex> lck(mu_);
+			busy_--;
+			if (tasks_.empty() && busy_ == 0){
+				idle_cv_.notify_all();
+			}
+		}
+	}
+}
@@ -0,0 +1,99 @@
+
+#include "../src/Bitfield.hpp"
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// what first_and_not/count_and_not should return, one bit at a time
+static long first_reference(const Bitfield& a, const Bitfield& b, size_t from){
+    size_t bits = std::min(a.size(), b.size());
+    for (size_t i = from; i < bits; ++i) {
+        if (a.test(i) && !b.test(i)) {
+            return static_cast<long>(i);
+        }
+    }
+    return -1;
+}
+
+static size_t count_reference(const Bitfield& a, const Bitfield& b){
+    size_t c = 0;
+    for (size_t i = 0; i < std::min(a.size(), b.size()); ++i) {
+        if (a.test(i) && !b.test(i)) {
+            c++;
+        }
+    }
+    return c;
+}
+
+static void check(const Bitfield& a, const Bitfield& b){
+    size_t count = Bitfield::count_and_not(a, b);
+    assert(count == Bitfield::count_and_not_portable(a, b));
+    assert(count == count_reference(a, b));
+    for (size_t from = 0; from <= std::min(a.size(), b.size()) + 1; ++from) {
+        long first = Bitfield::first_and_not(a, b, from);
+        assert(first == Bitfield::first_and_not_portable(a, b, from));
+        assert(first == first_reference(a, b, from));
+    }
+}
+
+// one bit in percent of a, and b holding each of a's bits with keep percent
+static void fill(std::mt19937& rng, Bitfield& a, Bitfield& b, int percent, int keep){
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (static_cast<int>(rng() % 100) < percent) {
+            a.set(i);
+            if (i < b.size() && static_cast<int>(rng() % 100) < keep) {
+                b.set(i);
+            }
+        }
+    }
+}
+
+int main() {
+    std::cout << "AVX2: " << (Bitfield::accelerated() ? "yes" : "no, both paths are the scalar one") << std::endl;
+
+    // sizes around the word (64) and AVX2 block (256) boundaries
+    std::vector<size_t> sizes = {1, 7, 63, 64, 65, 127, 200, 255, 256, 257, 300, 511, 512, 513, 1000, 1025, 4099};
+    std::mt19937 rng(17);
+    for (size_t n : sizes) {
+        for (int percent : {0, 1, 10, 50, 100}) {
+            Bitfield a(n, false);
+            Bitfield b(n, false);
+            fill(rng, a, b, percent, 90);
+            check(a, b);
+            check(b, a);
+        }
+    }
+    std::cout << "AVX2 matches scalar [OK]" << std::endl;
+
+    // a single difference past the last full 256 bit block, and in the very last bit
+    for (size_t n : sizes) {
+        Bitfield a(n, true);
+        Bitfield b(n, true);
+        b.reset(n - 1);
+        check(a, b);
+        assert(Bitfield::count_and_not(a, b) == 1);
+        assert(Bitfield::first_and_not(a, b) == static_cast<long>(n - 1));
+        b.set(n - 1);
+        check(a, b);
+        assert(Bitfield::first_and_not(a, b) == -1);
+    }
+    std::cout << "difference in the tail [OK]" << std::endl;
+
+    // bits past size() stay zero: a full last byte on the wire and an all-ones bitfield count only real pieces
+    for (size_t n : sizes) {
+        std::vector<uint8_t> wire((n + 7) / 8 + 2, 0xff);
+        Bitfield a(n, false);
+        a.assign_bytes(std::span<const uint8_t>(wire));
+        assert(a.count() == n && a.all());
+        Bitfield none(n, false);
+        check(a, none);
+        assert(Bitfield::count_and_not(a, none) == n);
+        assert(Bitfield::count_and_not(Bitfield(n, true), none) == n);
+        assert(Bitfield::first_and_not(a, none, n - 1) == static_cast<long>(n - 1));
+        assert(Bitfield::first_and_not(a, none, n) == -1);
+    }
+    std::cout << "tail word masking [OK]" << std::endl;
+    return 0;
+}
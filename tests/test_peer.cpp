@@ -2,39 +2,65 @@
 #include "../src/Peer.hpp"
 #include "../src/Header.hpp"
 #include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
 #include <unistd.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <arpa/inet.h>
+#include <sys/stat.h>
+
+static std::string read_file(const std::string& path){
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
 
 int main() {
-    unsigned int file_size  = 128 * 1024;  // 128 KiB
-    unsigned int piece_size = 32 * 1024;   // 32 KiB
+    unsigned int file_size  = 128 * 1024 + 1000;  // 128 KiB and a short last piece
+    unsigned int piece_size = 32 * 1024;          // 32 KiB
 
-    // Note: ctor now takes a final bool has_file
-    P2P_Client clientA(1001, 5001, "127.0.0.1", 0, 0, "temp.txt", file_size, piece_size, true);
-    std::cout << "Created ClientA [OK]" << std::endl;
+    // peers keep their copy in peer_<id>/, run in a scratch directory
+    char dir[] = "/tmp/test_peerXXXXXX";
+    assert(::mkdtemp(dir) != nullptr);
+    assert(::chdir(dir) == 0);
+    ::mkdir("peer_1001", 0755);
+    ::mkdir("peer_1002", 0755);
 
-    P2P_Client clientB(1002, 5002, "127.0.0.1", 0, 0, "temp.txt", file_size, piece_size, false);
-    std::cout << "Created ClientB [OK]" << std::endl;
+    std::string data(file_size, '\0');
+    std::mt19937 rng(7);
+    for (auto& c : data) {
+        c = static_cast<char>(rng());
+    }
+    {
+        std::ofstream out("peer_1001/temp.txt", std::ios::binary);
+        out.write(data.data(), data.size());
+    }
 
-    // socketpair for testing
-    int sv[2];
-    assert(::socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    {
+        P2P_Client clientA(1001, 5001, "127.0.0.1", 1, 1, "temp.txt", file_size, piece_size, true, {});
+        assert(clientA.has_complete_file());
+        std::cout << "Created ClientA [OK]" << std::endl;
 
-    // handshake test
-    assert(clientA.send_handshake(sv[0], clientA.peer_id()));
-    assert(clientB.read_handshake(sv[1], "127.0.0.1", clientA.port()));
-    std::cout << "handshake test [OK]" << std::endl;
+        // connects to A and handshakes in the constructor
+        std::vector<InitNeighborInfo> neighbors = {{1001, "127.0.0.1", true, 5001}};
+        P2P_Client clientB(1002, 5002, "127.0.0.1", 1, 1, "temp.txt", file_size, piece_size, false, neighbors);
+        assert(!clientB.has_complete_file());
+        std::cout << "Created ClientB [OK]" << std::endl;
 
-    // simple message: HAVE
-    uint32_t piece = htonl(1);
-    assert(clientA.send_message(HAVE, &piece, sizeof(piece), sv[0]));
-    assert(clientB.read_message(sv[1])); // should route to read_have(...)
-    std::cout << "simple message test [OK]" << std::endl;
+        // BITFIELD, INTERESTED, UNCHOKE, REQUEST/PIECE and HAVE until B has every piece
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        while (!clientB.has_complete_file() && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        assert(clientB.has_complete_file());
+        std::cout << "transfer test [OK]" << std::endl;
+    }
 
-    ::close(sv[0]);
-    ::close(sv[1]);
+    // both destructors ran, everything written is on disk
+    assert(read_file("peer_1002/temp.txt") == data);
+    std::cout << "file contents test [OK]" << std::endl;
     return 0;
 }
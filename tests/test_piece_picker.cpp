@@ -0,0 +1,138 @@
+
+#include "../src/PiecePicker.hpp"
+#include "../src/Bitfield.hpp"
+#include <cassert>
+#include <iostream>
+#include <set>
+#include <vector>
+
+static const int PIECES = 200;
+
+static Bitfield pieces_of(std::initializer_list<int> list){
+    Bitfield b(PIECES, false);
+    for (int i : list) {
+        b.set(i);
+    }
+    return b;
+}
+
+// every piece pick() would look at for theirs, in the order it looks at them
+static std::vector<int> walk(PiecePicker& picker, const Bitfield& theirs){
+    std::vector<int> seen;
+    assert(picker.pick(theirs, [&seen](int i){ seen.push_back(i); return false; }) == -1);
+    return seen;
+}
+
+// the buckets hold exactly the pieces we lack that someone has, each once, rarest first
+static void check_buckets(PiecePicker& picker, const Bitfield& have, const std::vector<uint32_t>& expected){
+    Bitfield all(PIECES, true);
+    std::vector<int> seen = walk(picker, all);
+    std::set<int> unique(seen.begin(), seen.end());
+    assert(unique.size() == seen.size());
+    size_t want = 0;
+    for (int i = 0; i < PIECES; ++i) {
+        assert(picker.availability(i) == expected[i]);
+        if (!have.test(i) && expected[i] > 0) {
+            want++;
+            assert(unique.count(i) == 1);
+        }
+    }
+    assert(seen.size() == want);
+    for (size_t k = 1; k < seen.size(); ++k) {
+        assert(picker.availability(seen[k - 1]) <= picker.availability(seen[k]));
+    }
+}
+
+int main() {
+    Bitfield have = pieces_of({0, 1, 2});
+    PiecePicker picker(have);
+    std::vector<uint32_t> expected(PIECES, 0);
+    check_buckets(picker, have, expected);
+    assert(picker.pick(Bitfield(PIECES, true), [](int){ return true; }) == -1); // nobody has anything
+    std::cout << "empty picker [OK]" << std::endl;
+
+    // two neighbors' BITFIELDs
+    Bitfield a(PIECES, false);
+    Bitfield b(PIECES, false);
+    for (int i = 0; i < PIECES; ++i) {
+        if (i % 2 == 0) { a.set(i); expected[i]++; }
+        if (i % 3 == 0) { b.set(i); expected[i]++; }
+    }
+    picker.add_peer(a);
+    picker.add_peer(b);
+    check_buckets(picker, have, expected);
+    std::cout << "add_peer [OK]" << std::endl;
+
+    // HAVEs move pieces up a bucket, one at a time and repeatedly
+    for (int i : {5, 5, 7, 0, 199, 6}) {
+        picker.on_have(i);
+        expected[i]++;
+        check_buckets(picker, have, expected);
+    }
+    std::cout << "on_have [OK]" << std::endl;
+
+    // rarest first: piece 11 is only with c, everything else b also has is more common
+    Bitfield c = pieces_of({11, 12, 18});
+    picker.add_peer(c);
+    for (int i : {11, 12, 18}) {
+        expected[i]++;
+    }
+    check_buckets(picker, have, expected);
+    assert(picker.pick(c, [](int){ return true; }) == 11);
+    std::cout << "rarest first [OK]" << std::endl;
+
+    // a new BITFIELD replaces what a neighbor had
+    Bitfield a2 = pieces_of({1, 3, 11, 100});
+    picker.remove_peer(a);
+    picker.add_peer(a2);
+    for (int i = 0; i < PIECES; ++i) {
+        if (a.test(i)) expected[i]--;
+        if (a2.test(i)) expected[i]++;
+    }
+    check_buckets(picker, have, expected);
+    std::cout << "bitfield replacement [OK]" << std::endl;
+
+    // completed pieces leave the buckets but keep their count
+    for (int i : {11, 18, 100}) {
+        picker.on_complete(i);
+        have.set(i);
+    }
+    check_buckets(picker, have, expected);
+    assert(picker.pick(c, [](int){ return true; }) == 12);
+    std::cout << "on_complete [OK]" << std::endl;
+
+    // disconnects, counts never go below zero
+    picker.remove_peer(b);
+    picker.remove_peer(c);
+    picker.remove_peer(a2);
+    for (int i = 0; i < PIECES; ++i) {
+        if (b.test(i)) expected[i]--;
+        if (c.test(i)) expected[i]--;
+        if (a2.test(i)) expected[i]--;
+    }
+    check_buckets(picker, have, expected);
+    picker.remove_peer(c);
+    check_buckets(picker, have, expected);
+    std::cout << "disconnect [OK]" << std::endl;
+
+    // reservations: a reserved piece isn't picked again until released
+    Bitfield d = pieces_of({20, 21});
+    picker.add_peer(d);
+    int first = picker.pick_and_reserve(d, 7, [](int){ return true; });
+    int second = picker.pick_and_reserve(d, 8, [](int){ return true; });
+    assert(first >= 0 && second >= 0 && first != second);
+    assert(picker.pick_and_reserve(d, 9, [](int){ return true; }) == -1);
+    picker.release_peer(7);
+    assert(picker.pick(d, [](int){ return true; }) == first);
+    std::cout << "reservations [OK]" << std::endl;
+
+    // read-ahead guess: what we have and they lack, rarest first
+    PiecePicker seeded(Bitfield(PIECES, true));
+    seeded.add_peer(pieces_of({30, 31, 32}));
+    seeded.add_peer(pieces_of({30, 31}));
+    seeded.add_peer(pieces_of({30}));
+    std::vector<int> guess = seeded.rarest_missing(pieces_of({30, 31, 32, 33}), pieces_of({}), 3, 33);
+    assert((guess == std::vector<int>{32, 31, 30}));
+    std::cout << "rarest_missing [OK]" << std::endl;
+    return 0;
+}
@@ -0,0 +1,51 @@
+
+#include "../src/Sha256.hpp"
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::string hex(const sha256::Digest& d){
+    std::string out;
+    char buf[3];
+    for (uint8_t b : d) {
+        std::snprintf(buf, sizeof(buf), "%02x", b);
+        out += buf;
+    }
+    return out;
+}
+
+int main() {
+    std::cout << "SHA extensions: " << (sha256::accelerated() ? "yes" : "no, both paths are the portable one") << std::endl;
+
+    // FIPS 180-2 examples: one block, two blocks (padding spills over), many blocks
+    struct Vector { std::string input; const char* digest; };
+    std::vector<Vector> vectors = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    };
+    for (const auto& v : vectors) {
+        assert(hex(sha256::hash(v.input.data(), v.input.size())) == v.digest);
+        assert(hex(sha256::hash_portable(v.input.data(), v.input.size())) == v.digest);
+    }
+    std::cout << "known vectors [OK]" << std::endl;
+
+    // every length around the block and padding boundaries, then piece-sized inputs
+    std::mt19937 rng(11);
+    std::vector<char> data(256 * 1024 + 3);
+    for (auto& c : data) {
+        c = static_cast<char>(rng());
+    }
+    for (size_t len = 0; len <= 300; ++len) {
+        assert(sha256::hash(data.data(), len) == sha256::hash_portable(data.data(), len));
+    }
+    for (size_t len : {size_t(16384), size_t(32 * 1024 + 1000), data.size()}) {
+        assert(sha256::hash(data.data(), len) == sha256::hash_portable(data.data(), len));
+    }
+    std::cout << "accelerated matches portable [OK]" << std::endl;
+    return 0;
+}
@@ -0,0 +1,123 @@
+
+#include "../src/TimerWheel.hpp"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using Clock = TimerWheel::Clock;
+using namespace std::chrono_literals;
+
+static void wait_for(const std::atomic<int>& value, int target, Clock::duration limit){
+    auto deadline = Clock::now() + limit;
+    while (value.load() < target && Clock::now() < deadline) {
+        std::this_thread::sleep_for(1ms);
+    }
+}
+
+int main() {
+    // a 100 us tick puts level 1 at 6.4 ms and level 2 at 409.6 ms, so both wraps happen within a second
+    {
+        TimerWheel wheel(100us);
+        struct Fired { Clock::duration delay; Clock::duration after; };
+        std::vector<Clock::duration> delays = {1ms, 5ms, 6400us, 7ms, 30ms, 100ms, 409ms, 410ms, 500ms, 900ms};
+        std::vector<Fired> fired;
+        std::mutex mu;
+        std::atomic<int> runs{0};
+        auto start = Clock::now();
+        for (auto d : delays) {
+            wheel.after(d, [&, d]{
+                std::lock_guard<std::mutex> lck(mu);
+                fired.push_back({d, Clock::now() - start});
+                runs++;
+            });
+        }
+        wait_for(runs, static_cast<int>(delays.size()), 5s);
+        assert(runs == static_cast<int>(delays.size()));
+        for (const auto& f : fired) {
+            assert(f.after >= f.delay);        // never early
+            assert(f.after < f.delay + 100ms); // and not lost in a level above
+        }
+        assert(wheel.pending() == 0);
+    }
+    std::cout << "deadlines across level 1 and level 2 [OK]" << std::endl;
+
+    // periodic: runs every period until cancelled, then never again
+    {
+        TimerWheel wheel(1ms);
+        std::atomic<int> runs{0};
+        auto id = wheel.every(20ms, [&]{ runs++; });
+        std::this_thread::sleep_for(310ms);
+        assert(wheel.cancel(id));
+        int seen = runs.load();
+        assert(seen >= 10 && seen <= 16);
+        std::this_thread::sleep_for(60ms);
+        assert(runs == seen);
+        assert(!wheel.cancel(id));
+        assert(wheel.pending() == 0);
+    }
+    std::cout << "periodic rescheduling [OK]" << std::endl;
+
+    // cancel while a task runs: from inside the task, and from another thread
+    {
+        TimerWheel wheel(1ms);
+        std::atomic<int> self_runs{0};
+        std::atomic<int> victim_runs{0};
+        std::atomic<int> slow_started{0};
+        TimerWheel::TimerId self = 0;
+        TimerWheel::TimerId victim = 0;
+        std::mutex ids;
+        {
+            std::lock_guard<std::mutex> lck(ids);
+            self = wheel.every(5ms, [&]{
+                self_runs++;
+                std::lock_guard<std::mutex> l(ids);
+                wheel.cancel(self);
+                wheel.cancel(victim); // due later, from the same thread
+            });
+            victim = wheel.after(20ms, [&]{ victim_runs++; });
+        }
+        std::this_thread::sleep_for(60ms);
+        assert(self_runs == 1);
+        assert(victim_runs == 0);
+
+        std::atomic<int> late_runs{0};
+        std::atomic<bool> release{false};
+        wheel.after(5ms, [&]{
+            slow_started++;
+            while (!release) {
+                std::this_thread::sleep_for(1ms);
+            }
+        });
+        auto late = wheel.after(40ms, [&]{ late_runs++; });
+        wait_for(slow_started, 1, 1s);
+        assert(slow_started == 1);
+        std::this_thread::sleep_for(60ms); // its deadline passes while the slow task holds the thread
+        assert(wheel.cancel(late));
+        release = true;
+        std::this_thread::sleep_for(20ms);
+        assert(late_runs == 0);
+        assert(wheel.pending() == 0);
+    }
+    std::cout << "cancel during a run [OK]" << std::endl;
+
+    // stop() doesn't wait for the next deadline, however far it is
+    {
+        TimerWheel wheel(10ms);
+        std::atomic<int> runs{0};
+        wheel.after(std::chrono::hours(1), [&]{ runs++; });
+        wheel.every(std::chrono::minutes(5), [&]{ runs++; });
+        std::this_thread::sleep_for(20ms);
+        auto start = Clock::now();
+        wheel.stop();
+        assert(Clock::now() - start < 50ms);
+        assert(runs == 0);
+        assert(wheel.pending() == 0);
+        assert(wheel.after(1ms, [&]{ runs++; }) == 0); // nothing is added once stopped
+    }
+    std::cout << "stop() returns promptly [OK]" << std::endl;
+    return 0;
+}